@@ -0,0 +1,227 @@
+// arith.c
+//
+// Arithmetic expansion for Bsh.  See arith.h for details.
+//
+// expr() parses and evaluates an operand and then each binary operator whose
+// precedence is at least its argument, recursing with a higher minimum for
+// the right operand.  When the value of an operand is not needed (the right
+// of a short-circuited && or ||, or the arm of ?: not selected), it is
+// parsed with SKIP set so that it cannot fail at run time.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "arith.h"
+
+#define TRUE (1)
+#define FALSE (0)
+
+typedef struct {
+    const char *s;                  // next char to parse
+    const char *error;              // first error found (or NULL)
+} parser;
+
+static const struct binop {         // binary operators, longest first
+    const char *op;
+    int prec;                       // precedence (higher binds tighter)
+} binops[] = {
+    { "<<", 8 }, { ">>", 8 }, { "<=", 7 }, { ">=", 7 }, { "==", 6 },
+    { "!=", 6 }, { "&&", 2 }, { "||", 1 },
+    { "*", 10 }, { "/", 10 }, { "%", 10 }, { "+", 9 },  { "-", 9 },
+    { "<", 7 },  { ">", 7 },  { "&", 5 },  { "^", 4 },  { "|", 3 },
+};
+
+static long long expr(parser *p, int minPrec, int skip);
+
+
+// Record the error MSG (unless there already is one)
+static long long fail(parser *p, const char *msg)
+{
+    if (p->error == NULL)
+        p->error = msg;
+    return 0;
+}
+
+
+// Skip whitespace; return the next char
+static char next(parser *p)
+{
+    while (isspace((unsigned char) *p->s))
+        p->s++;
+    return *p->s;
+}
+
+
+// Convert the constant at the start of S to *VALUE; return the char after it
+// (NULL if there is none or it is out of range)
+static const char *constant(const char *s, long long *value)
+{
+    char *end;
+
+    if (!isdigit((unsigned char) *s))
+        return NULL;
+    errno = 0;
+    *value = (long long) strtoull(s, &end, 0);  // wrap like C
+    return (errno == 0) ? end : NULL;
+}
+
+
+// Return the value of the variable whose name is the LEN chars at NAME
+static long long variable(parser *p, const char *name, size_t len)
+{
+    char copy[len + 1];
+    const char *value, *end;
+    long long n = 0;
+
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    if ((value = getenv(copy)) == NULL)
+        return 0;
+    while (isspace((unsigned char) *value))
+        value++;
+    if (*value == '\0')
+        return 0;
+
+    int negative = (*value == '-');
+    if ((end = constant(value + negative, &n)) == NULL)
+        return fail(p, "variable value is not a number");
+    while (isspace((unsigned char) *end))
+        end++;
+    if (*end != '\0')
+        return fail(p, "variable value is not a number");
+    return negative ? (long long) -(unsigned long long) n : n;
+}
+
+
+// Parse and evaluate an operand (a constant, NAME, or parenthesized
+// expression, possibly preceded by unary operators)
+static long long operand(parser *p, int skip)
+{
+    char c = next(p);
+    long long value;
+    const char *end;
+
+    if (c == '!' || c == '~' || c == '-' || c == '+') {
+        p->s++;
+        value = operand(p, skip);
+        return (c == '!') ? !value
+             : (c == '~') ? ~value
+             : (c == '-') ? (long long) -(unsigned long long) value
+             : value;
+    } else if (c == '(') {
+        p->s++;
+        value = expr(p, 0, skip);
+        if (next(p) != ')')
+            return fail(p, "missing )");
+        p->s++;
+        return value;
+    } else if (isalpha((unsigned char) c) || c == '_') {
+        const char *name = p->s;
+        while (isalnum((unsigned char) *p->s) || *p->s == '_')
+            p->s++;
+        return skip ? 0 : variable(p, name, p->s - name);
+    } else if ((end = constant(p->s, &value)) != NULL) {
+        p->s = end;
+        return value;
+    }
+
+    return fail(p, (c == '\0') ? "missing operand" : "syntax error");
+}
+
+
+// Return the binary operator at the next char (NULL if none)
+static const struct binop *binop(parser *p)
+{
+    char c = next(p);
+
+    for (int i = 0; i < sizeof(binops) / sizeof(binops[0]); i++) {
+        const char *op = binops[i].op;
+        if (op[0] == c && (op[1] == '\0' || op[1] == p->s[1]))
+            return &binops[i];
+    }
+    return NULL;
+}
+
+
+// Apply the binary operator OP to A and B
+static long long apply(parser *p, const char *op, long long a, long long b)
+{
+    unsigned long long ua = a, ub = b;  // for wrapping arithmetic
+
+    switch (op[0]) {
+    case '*':   return (long long) (ua * ub);
+    case '+':   return (long long) (ua + ub);
+    case '-':   return (long long) (ua - ub);
+    case '&':   return a & b;
+    case '^':   return a ^ b;
+    case '|':   return a | b;
+    case '=':   return a == b;
+    case '!':   return a != b;
+    case '/':
+    case '%':
+        if (b == 0)
+            return fail(p, "division by zero");
+        else if (b == -1)               // INT64_MIN / -1 would trap
+            return (op[0] == '/') ? (long long) -ua : 0;
+        return (op[0] == '/') ? a / b : a % b;
+    case '<':
+        return (op[1] == '<') ? (long long) (ua << (b & 63))
+             : (op[1] == '=') ? a <= b : a < b;
+    case '>':
+        return (op[1] == '>') ? a >> (b & 63)
+             : (op[1] == '=') ? a >= b : a > b;
+    }
+    return 0;
+}
+
+
+// Parse and evaluate an expression whose binary operators all have
+// precedence at least MINPREC (0 for a whole expression, including ?:)
+static long long expr(parser *p, int minPrec, int skip)
+{
+    const struct binop *op;
+    long long value = operand(p, skip);
+
+    while ((op = binop(p)) != NULL && op->prec >= minPrec) {
+        p->s += strlen(op->op);
+        if (strcmp(op->op, "&&") == 0) {
+            long long right = expr(p, op->prec + 1, skip || !value);
+            value = value && right;
+        } else if (strcmp(op->op, "||") == 0) {
+            long long right = expr(p, op->prec + 1, skip || value);
+            value = value || right;
+        } else {
+            long long right = expr(p, op->prec + 1, skip);
+            value = skip ? 0 : apply(p, op->op, value, right);
+        }
+    }
+
+    if (minPrec == 0 && next(p) == '?') {       // COND ? A : B
+        p->s++;
+        long long a = expr(p, 0, skip || !value);
+        if (next(p) != ':')
+            return fail(p, "missing :");
+        p->s++;
+        long long b = expr(p, 0, skip || value);
+        value = value ? a : b;
+    }
+    return value;
+}
+
+
+int arith(const char *text, long long *value)
+{
+    parser p = { text, NULL };
+
+    *value = expr(&p, 0, FALSE);
+    if (p.error == NULL && next(&p) != '\0')
+        fail(&p, "syntax error");
+    if (p.error != NULL) {
+        fprintf(stderr, "Bsh: %s: %s\n", text, p.error);
+        return -1;
+    }
+    return 0;
+}
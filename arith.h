@@ -0,0 +1,38 @@
+// arith.h
+//
+// Arithmetic expansion for Bsh.  A word may contain $((EXPRESSION)), which is
+// replaced by the value of EXPRESSION in decimal.  Variable references and
+// command substitutions in EXPRESSION are expanded first (see expand.h); the
+// result is then evaluated with the 64-bit signed integer semantics of C:
+//
+//   ( )                    grouping
+//   ! ~ - +                unary operators
+//   * / %                  (division by zero is an error)
+//   + -
+//   << >>                  (the shift count is taken modulo 64)
+//   < <= > >=
+//   == !=
+//   &
+//   ^
+//   |
+//   &&                     (the right operand is evaluated only if needed)
+//   ||
+//   ? :                    (only the operand selected is evaluated)
+//
+// with operators listed in order of decreasing precedence; all binary
+// operators associate left to right, and ?: right to left.  Overflow wraps
+// around.  Operands are decimal, octal (leading 0), or hexadecimal (leading
+// 0x) constants, or variable NAMEs, whose values must be such constants (an
+// unset or empty variable is 0).
+//
+// The evaluator is a precedence-climbing parser that works directly on the
+// text and allocates no storage.
+
+#ifndef ARITH_INCLUDED
+#define ARITH_INCLUDED
+
+// Evaluate the expression EXPR and store its value in *VALUE; return 0, or
+// -1 after printing a message if EXPR is invalid
+int arith (const char *expr, long long *value);
+
+#endif
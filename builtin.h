@@ -0,0 +1,48 @@
+// builtin.h
+//
+// Built-in commands for Bsh that are not implemented in process.c.  Each is
+// called with the expanded argument vector of a SIMPLE command (after any
+// redirection, unless noted) and returns its exit status.
+
+#ifndef BUILTIN_INCLUDED
+#define BUILTIN_INCLUDED
+
+// tee [-a] FILE ...
+//
+// Copy the standard input to the standard output and to each FILE (appending
+// if -a).  When the standard input is a pipe the data are duplicated with
+// tee(2) and moved with splice(2) so that they never pass through user
+// memory; otherwise they are copied through a buffer.
+int teeCMD (int argc, char **argv);
+
+// read [-r] [NAME ...]
+//
+// Read a line from the descriptor IN (the standard input, or the file it is
+// redirected from, since read runs in the shell itself) and assign its
+// fields, separated by runs of the characters in $IFS (default space, tab,
+// and newline), to the variables NAME ... (default REPLY), the last getting
+// the rest of the line.  Unless -r, a backslash quotes the next char and a
+// backslash-newline joins the next line.  The status is 1 if the end of file
+// is reached before a newline.  No input after the newline is consumed, but
+// the input is read in blocks rather than a byte at a time (see read.c).
+int readCMD (int argc, char **argv, int in);
+
+// bshstat [-r]
+//
+// Print the shell's counters (see stats.h) as NAME=VALUE lines, or reset
+// them to zero if -r.
+int bshstatCMD (int argc, char **argv);
+
+// ulimit [-SH] [-a | -cdflnstuvMC] [LIMIT]
+//
+// Print or set the soft (-S) or hard (-H) limit on a resource for the jobs
+// run by the shell (see ulimit.h), like the ulimit of bash: -c core file size
+// (512-byte blocks), -d data segment (kbytes), -f file size (blocks, the
+// default), -l locked memory (kbytes), -n open files, -s stack (kbytes), -t
+// cpu time (seconds), -u processes, or -v virtual memory (kbytes); or -M the
+// memory (kbytes) or -C the cpu time (percent of one cpu) of each job as a
+// whole.  LIMIT may be "unlimited".  Setting a limit with neither -S nor -H
+// sets both.  -a prints all limits.
+int ulimitCMD (int argc, char **argv);
+
+#endif
@@ -0,0 +1,318 @@
+// control.c
+//
+// Recognize for and while loops and function definitions in a token list,
+// parse their parts once, and splice the resulting subtrees into the tree
+// built by parse().  See control.h for the syntax.
+//
+// Each loop (or definition) is replaced in the token list by a single SIMPLE
+// token whose text is PLACEHOLDER followed by an index into loops[]; parse()
+// turns it into a SIMPLE (with any redirection that follows the loop), which
+// resolve() then converts into the loop itself.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "control.h"
+
+#define TRUE (1)
+#define FALSE (0)
+#define PLACEHOLDER '\001'          // first char of placeholder token text
+
+static CMD **loops = NULL;          // loops and definitions parsed but not
+                                    //   yet resolved
+static int nLoops = 0,              // number of entries used in loops[]
+           maxLoops = 0;            // number of entries allocated
+
+
+// Is token T the SIMPLE token WORD?
+static int isWord(token *t, char *word)
+{
+    return t != NULL && t->type == SIMPLE && strcmp(t->text, word) == 0;
+}
+
+
+// Can the token after T (at the start of a command if START) begin a command?
+static int nextStarts(token *t, int start)
+{
+    return t->type == SEP_END || t->type == SEP_BG  || t->type == SEP_AND
+        || t->type == SEP_OR  || t->type == RED_PIPE || t->type == PAR_LEFT
+        || (start && (isWord(t, "do") || isWord(t, "{")))
+        || (t->type == PAR_RIGHT && isWord(t->next, "{"));
+}
+
+
+// Return the token in the list FROM that is KEY ("do" or "done"), is at the
+// start of a command, and is not part of a nested loop (or NULL if none).
+// Set *LAST to the token before it.  (The { and } of a definition cannot
+// contain an unmatched do or done, so they need not be tracked.)
+static token *findKeyword(token *from, token **last, char *key)
+{
+    int depth = 0,                  // number of nested loops entered
+        start = TRUE;               // at start of a command?
+
+    for (token *t = from, *prev = NULL; t; prev = t, t = t->next) {
+        if (start && (isWord(t, "for") || isWord(t, "while"))) {
+            depth++;
+        } else if (start && isWord(t, key) && depth == 0) {
+            *last = prev;
+            return t;
+        } else if (start && isWord(t, "done")) {
+            depth--;
+        }
+        start = nextStarts(t, start);
+    }
+    return NULL;
+}
+
+
+// Cut the list FROM before token END, parse it, and then restore it
+static CMD *parseSublist(token *from, token *last, token *end)
+{
+    CMD *cmd;
+
+    last->next = NULL;
+    cmd = parseControl(from);
+    last->next = end;
+    return cmd;
+}
+
+
+// Is the name S a valid variable name?
+static int isName(char *s)
+{
+    if (!isalpha((unsigned char) *s) && *s != '_')
+        return FALSE;
+    while (isalnum((unsigned char) *s) || *s == '_')
+        s++;
+    return *s == '\0';
+}
+
+
+// Append a copy of the string ARG to the argument vector of C
+static void addArg(CMD *c, char *arg)
+{
+    c->argv = realloc(c->argv, (c->argc+2) * sizeof(char *));
+    c->argv[c->argc++] = strdup(arg);
+    c->argv[c->argc] = NULL;
+}
+
+
+// Return the } in the list FROM that is at the start of a command and is not
+// part of a nested definition (or NULL if none).  Set *LAST to the token
+// before it.
+static token *findBrace(token *from, token **last)
+{
+    int depth = 0,                  // number of nested definitions entered
+        start = TRUE;               // at start of a command?
+
+    for (token *t = from, *prev = NULL; t; prev = t, t = t->next) {
+        if (start && isWord(t, "{")) {
+            depth++;
+        } else if (start && isWord(t, "}") && depth-- == 0) {
+            *last = prev;
+            return t;
+        }
+        start = nextStarts(t, start);
+    }
+    return NULL;
+}
+
+
+// Add C to loops[] and replace the tokens from FIRST to LAST in the list by a
+// placeholder token for it
+static void replace(token *first, token *last, CMD *c)
+{
+    token *t;
+
+    if (nLoops == maxLoops) {           // add C to loops[]
+        maxLoops = 2 * maxLoops + 4;
+        loops = realloc(loops, maxLoops * sizeof(CMD *));
+    }
+    loops[nLoops] = c;
+
+    t = first->next;                    // replace FIRST ... LAST by
+    first->next = last->next;           //   placeholder
+    last->next = NULL;
+    freeList(t);
+    free(first->text);
+    first->type = SIMPLE;
+    if (asprintf(&first->text, "%c%d", PLACEHOLDER, nLoops++) < 0) {
+        perror("Bsh");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Is the token NAME the start of a definition NAME ( ) { ?
+static int isDefinition(token *name)
+{
+    token *t = name->next;
+
+    return name->type == SIMPLE && isName(name->text)
+        && t && t->type == PAR_LEFT && (t = t->next) && t->type == PAR_RIGHT
+        && isWord(t->next, "{");
+}
+
+
+// Parse the definition beginning with the token NAME, add it to loops[], and
+// replace it in the list by a placeholder token; return FALSE on error
+static int definition(token *name)
+{
+    token *brace = name->next->next->next, *last, *close;
+    CMD *def;
+
+    close = findBrace(brace->next, &last);
+    if (close == NULL || last == NULL || last == brace
+          || (last->type != SEP_END && last->type != SEP_BG)) {
+        fprintf(stderr, "Bsh: %s: missing ; }\n", name->text);
+        return FALSE;
+    }
+
+    def = mallocCMD();
+    def->type = FUNC_DEF;
+    addArg(def, name->text);
+    if ((def->left = parseSublist(brace->next, last, close)) == NULL) {
+        freeCMD(def);
+        return FALSE;
+    }
+    replace(name, close, def);
+    return TRUE;
+}
+
+
+// Parse the loop beginning with the keyword token KEY, add it to loops[], and
+// replace it in the list by a placeholder token; return FALSE on error
+static int compound(token *key)
+{
+    token *t, *last, *doKey, *doneKey;
+    CMD *loop = mallocCMD();
+
+    if (isWord(key, "for")) {           // for NAME in WORD ... ; do
+        loop->type = FOR_LOOP;
+        if (!(t = key->next) || t->type != SIMPLE || !isName(t->text)
+              || !isWord(t->next, "in")) {
+            fprintf(stderr, "Bsh: for: expected NAME in\n");
+            freeCMD(loop);
+            return FALSE;
+        }
+        addArg(loop, t->text);
+        for (t = t->next->next; t && t->type == SIMPLE; t = t->next)
+            addArg(loop, t->text);
+        if (t == NULL || t->type != SEP_END || !isWord(t->next, "do")) {
+            fprintf(stderr, "Bsh: for: missing ; do\n");
+            freeCMD(loop);
+            return FALSE;
+        }
+        doKey = t->next;
+
+    } else {                            // while <command> do
+        loop->type = WHILE_LOOP;
+        doKey = findKeyword(key->next, &last, "do");
+        if (doKey == NULL || last == NULL
+              || (last->type != SEP_END && last->type != SEP_BG)) {
+            fprintf(stderr, "Bsh: while: missing ; do\n");
+            freeCMD(loop);
+            return FALSE;
+        }
+        if ((loop->left = parseSublist(key->next, last, doKey)) == NULL) {
+            freeCMD(loop);
+            return FALSE;
+        }
+    }
+
+    doneKey = findKeyword(doKey->next, &last, "done");
+    if (doneKey == NULL || last == NULL || last == doKey
+          || (last->type != SEP_END && last->type != SEP_BG)) {
+        fprintf(stderr, "Bsh: %s: missing ; done\n", key->text);
+        freeCMD(loop);
+        return FALSE;
+    }
+
+    CMD *body = parseSublist(doKey->next, last, doneKey);
+    if (body == NULL) {
+        freeCMD(loop);
+        return FALSE;
+    }
+    if (loop->type == FOR_LOOP)
+        loop->left = body;
+    else
+        loop->right = body;
+
+    replace(key, doneKey, loop);
+    return TRUE;
+}
+
+
+// Replace each placeholder in the tree rooted at C by its loop; return FALSE
+// if some placeholder is followed by arguments
+static int resolve(CMD *c)
+{
+    if (c == NULL)
+        return TRUE;
+
+    int i;                          // index of loop in loops[]
+
+    if (c->type == SIMPLE && c->argv[0][0] == PLACEHOLDER
+          && (i = atoi(c->argv[0]+1)) < nLoops && loops[i] != NULL) {
+        CMD *loop = loops[i];
+        char *end = (loop->type == FUNC_DEF) ? "}" : "done";
+        int ok = (c->argc == 1);
+
+        if (!ok) {
+            fprintf(stderr, "Bsh: unexpected %s after %s\n", c->argv[1], end);
+        } else if (loop->type == FUNC_DEF
+                     && (c->fromType != NONE || c->toType != NONE)) {
+            fprintf(stderr, "Bsh: unexpected redirection after }\n");
+            ok = FALSE;
+        }
+        for (char **p = c->argv; *p; p++)
+            free(*p);
+        free(c->argv);
+
+        c->type = loop->type;           // move loop into C (keeping the
+        c->argc = loop->argc;           //   redirection that follows it)
+        c->argv = loop->argv;
+        c->left = loop->left;
+        c->right = loop->right;
+        loops[i] = NULL;
+        free(loop);
+        return ok;
+    }
+
+    return resolve(c->left) & resolve(c->right);
+}
+
+
+CMD *parseControl(token *list)
+{
+    int base = nLoops;              // loops[] entries below are not ours
+    int start = TRUE;               // at start of a command?
+    CMD *cmd = NULL;
+
+    for (token *t = list; t; t = t->next) {
+        if (start && (isWord(t, "for") || isWord(t, "while"))) {
+            if (!compound(t))
+                goto done;
+        } else if (start && isDefinition(t)) {
+            if (!definition(t))
+                goto done;
+        } else if (start && (isWord(t, "do") || isWord(t, "done")
+                               || isWord(t, "{") || isWord(t, "}"))) {
+            fprintf(stderr, "Bsh: unexpected %s\n", t->text);
+            goto done;
+        }
+        start = nextStarts(t, start);
+    }
+
+    if ((cmd = parse(list)) != NULL && !resolve(cmd)) {
+        freeCMD(cmd);
+        cmd = NULL;
+    }
+
+  done:
+    while (nLoops > base)           // free loops not resolved (on error)
+        freeCMD(loops[--nLoops]);
+    return cmd;
+}
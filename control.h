@@ -0,0 +1,39 @@
+// control.h
+//
+// Control structures for Bsh, recognized in the token list before parse()
+// sees it.  The syntax extends <stage> in parse.h with
+//
+//   <stage>    = ... / <for> / <while> / <function>
+//   <for>      = for NAME in WORD ... ; do <command> done
+//   <while>    = while <command> do <command> done
+//   <function> = NAME ( ) { <command> }
+//
+// where the keywords for, while, do, done, {, and } are recognized only at
+// the start of a command (after ;, &, &&, ||, |, (, do, or {, or the { after
+// NAME ( )) and the <command> before do, done, or } must end with ; or &.
+// Like a subcommand, a loop may have I/O redirection (after the done).
+//
+// Each line is parsed on its own, so a loop or definition must be complete
+// on one line.  A do, done, {, or } at the start of a command that is not
+// part of a loop or definition on the same line is an error (e.g., the rest
+// of a loop split across lines is rejected rather than run as commands).
+//
+// The tree for a <for> is a struct of type FOR_LOOP whose argv[] holds NAME
+// followed by the WORDs, whose left child is the tree for the body, and whose
+// right child is NULL.  The tree for a <while> is a struct of type WHILE_LOOP
+// whose left child is the tree for the condition and whose right child is the
+// tree for the body.  The tree for a <function> is a struct of type FUNC_DEF
+// whose argv[] holds NAME and whose left child is the tree for the body (see
+// func.h).  Bodies are parsed once, when the line is parsed.
+
+#ifndef CONTROL_INCLUDED
+#define CONTROL_INCLUDED
+
+#include "parse.h"
+
+// Parse the token list LIST (which may be modified but is still freed by the
+// caller) into a command structure and return a pointer to that structure
+// (NULL if errors found)
+CMD *parseControl (token *list);
+
+#endif
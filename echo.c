@@ -0,0 +1,81 @@
+// echo.c
+//
+// The echo and dirs built-ins.  See echo.h for details.
+
+#include "process-stub.h"
+#include "echo.h"
+#include "stats.h"
+#include "func.h"
+
+
+int isEcho(CMD *cmd)
+{
+    return cmd->type == SIMPLE && cmd->argc > 0 && cmd->nLocal == 0
+        && cmd->fromType == NONE && cmd->toType == NONE
+        && (strcmp(cmd->argv[0], "echo") == 0
+            || strcmp(cmd->argv[0], "dirs") == 0)
+        && findFunc(cmd->argv[0]) == NULL;
+}
+
+
+// Store the output of echo ARGV in *OUTPUT and *LEN; return its status or -1
+static int echo(int argc, char **argv, char **output, size_t *len)
+{
+    int first = (argc > 1 && strcmp(argv[1], "-n") == 0) ? 2 : 1;
+    size_t n = 1;                       // for the newline or null
+    char *b;
+
+    if ((first < argc && argv[first][0] == '-' && argv[first][1] != '\0')
+          || getenv("POSIXLY_CORRECT") != NULL)
+        return -1;                      // an option only /bin/echo knows
+
+    for (int i = first; i < argc; i++)
+        n += strlen(argv[i]) + 1;
+    b = *output = malloc(n + 1);
+    for (int i = first; i < argc; i++) {
+        size_t m = strlen(argv[i]);
+        memcpy(b, argv[i], m);
+        b += m;
+        if (i < argc-1)
+            *b++ = ' ';
+    }
+    if (first == 1)
+        *b++ = '\n';
+    *b = '\0';
+    *len = b - *output;
+    return EXIT_SUCCESS;
+}
+
+
+// Store the output of dirs ARGV in *OUTPUT and *LEN; return its status
+static int dirs(int argc, char **argv, char **output, size_t *len)
+{
+    char *path;
+
+    if (argc != 1) {
+        fprintf(stderr, "usage: dirs\n");
+        return EXIT_FAILURE;
+    } else if ((path = getcwd(NULL, 0)) == NULL) {
+        perror("dirs");
+        return errno;
+    }
+    *len = asprintf(output, "%s\n", path);
+    free(path);
+    return EXIT_SUCCESS;
+}
+
+
+int echoText(int argc, char **argv, char **output, size_t *len)
+{
+    int status;
+
+    *output = NULL;
+    *len = 0;
+    if (strcmp(argv[0], "echo") == 0)
+        status = echo(argc, argv, output, len);
+    else
+        status = dirs(argc, argv, output, len);
+    if (status >= 0)
+        COUNT(builtins, 1);
+    return status;
+}
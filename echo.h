@@ -0,0 +1,35 @@
+// echo.h
+//
+// The echo and dirs built-ins of Bsh.  Their output is produced as a string,
+// so that one implementation serves every place they run: the child forked
+// for a SIMPLE command (see execSimple() in process.c), the shell itself for
+// dirs in the foreground, a pipeline stage run on a thread (see stage.h), and
+// a command substitution evaluated without a fork (see subst.c).
+//
+// echo [-n] WORD ...   Write the WORDs separated by spaces and followed by a
+//                      newline (unless -n)
+// dirs                 Write the current working directory and a newline
+//
+// echo implements only what the echo of coreutils does when it is given no
+// option other than -n and POSIXLY_CORRECT is not set (in particular, a
+// backslash has no special meaning).  For any other echo (e.g., echo -e or
+// echo --version), echoText() reports that the echo on $PATH must be executed
+// instead, so that the output is the same wherever the command runs.
+
+#ifndef ECHO_INCLUDED
+#define ECHO_INCLUDED
+
+#include <stddef.h>
+#include "parse.h"
+
+// Is CMD (expanded or not) a SIMPLE echo or dirs, with no local variables or
+// redirection, that has not been redefined as a function?
+int isEcho (CMD *cmd);
+
+// Store the output of the echo or dirs command ARGV (with ARGC words) in
+// *OUTPUT (a string of *LEN chars to be freed by the caller, or NULL) and
+// return its exit status, or return -1 if the command must be executed
+// instead (see above)
+int echoText (int argc, char **argv, char **output, size_t *len);
+
+#endif
@@ -0,0 +1,698 @@
+// expand.c
+//
+// Word expansion for Bsh.  See expand.h for details.
+
+#include "process-stub.h"
+#include <ctype.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "expand.h"
+#include "subst.h"
+#include "arith.h"
+
+#define TRUE (1)
+#define FALSE (0)
+
+#define CHUNK_SIZE  (64 * 1024)     // min size of a chunk of the stack
+#define DENTS_SIZE  (256 * 1024)    // size of getdents64() buffer
+#define CACHE_MAX   (16 * 1024 * 1024)  // max bytes of cached listings
+#define PARAM_DIGITS (16)           // max chars in $# (an int) and null
+#define LOCAL_PIECES (64)           // pieces of a word kept on the C stack
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Expanded copies are allocated from a stack of chunks so that releasing one
+// frees everything allocated after it as well.
+
+typedef struct chunk {
+    struct chunk *prev;             // chunk below this one (or NULL)
+    char *top;                      // first free byte
+    char *end;                      // end of data[]
+    char data[];
+} chunk;
+
+static chunk *stack = NULL;         // top chunk of the stack
+static int failed = FALSE;          // did an arithmetic expansion fail?
+
+
+// Allocate SIZE bytes on the stack
+static void *push(size_t size)
+{
+    size = (size + 7) & ~(size_t) 7;            // keep pointers aligned
+
+    if (stack == NULL || stack->end - stack->top < (ptrdiff_t) size) {
+        size_t n = (size > CHUNK_SIZE) ? size : CHUNK_SIZE;
+        chunk *c = malloc(sizeof(chunk) + n);
+        c->prev = stack;
+        c->top = c->data;
+        c->end = c->data + n;
+        stack = c;
+    }
+
+    void *p = stack->top;
+    stack->top += size;
+    return p;
+}
+
+
+// Free everything on the stack from P (returned by push()) up
+static void pop(void *p)
+{
+    while (!((char *) p >= stack->data && (char *) p < stack->end)) {
+        chunk *c = stack;
+        stack = c->prev;
+        free(c);
+    }
+    stack->top = p;
+}
+
+
+// Copy the first LEN chars of S onto the stack
+static char *pushString(const char *s, size_t len)
+{
+    char *copy = push(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// A growing list of words (pointers to the original or onto the stack)
+
+typedef struct {
+    int n, max;                     // number of words used and allocated
+    char **words;                   // array of words
+} wordList;
+
+
+// Append WORD to the list W
+static void addWord(wordList *w, char *word)
+{
+    if (w->n == w->max) {
+        w->max = 2 * w->max + 16;
+        w->words = realloc(w->words, w->max * sizeof(char *));
+    }
+    w->words[w->n++] = word;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Directory listings read for pathname expansion.  Entries are stored one
+// after the other in names[] as a d_type byte followed by the null-terminated
+// name.
+
+typedef struct listing {
+    struct listing *next;           // next listing in cache
+    char *dir;                      // directory as opened
+    size_t size;                    // number of bytes used in names[]
+    size_t max;                     // number of bytes allocated
+    char *names;                    // entries
+} listing;
+
+static listing *cache = NULL;       // listings read for this command line
+static size_t cacheBytes = 0;       // bytes used by cached listings
+
+
+void clearExpandCache(void)
+{
+    listing *l, *next;
+
+    for (l = cache; l; l = next) {
+        next = l->next;
+        free(l->dir);
+        free(l->names);
+        free(l);
+    }
+    cache = NULL;
+    cacheBytes = 0;
+}
+
+
+// Does WORD contain a pattern character?
+static int isPattern(const char *word)
+{
+    return strpbrk(word, "*?[") != NULL;
+}
+
+
+// Does WORD contain a $ or a command substitution?
+static int hasRefs(const char *word)
+{
+    return strchr(word, '$') != NULL || strchr(word, SUBST_MARK) != NULL;
+}
+
+
+// Does WORD contain a pattern character, a $, or a command substitution?
+static int isSpecial(const char *word)
+{
+    return isPattern(word) || hasRefs(word);
+}
+
+
+// If the bracket expression starting at *PAT is valid, set *PAT to the char
+// after it and return whether it matches C; otherwise return -1
+static int matchClass(const char **pat, char c)
+{
+    const char *p = *pat + 1;
+    int negate = (*p == '!' || *p == '^');
+    int found = FALSE;
+
+    if (negate)
+        p++;
+    for (const char *first = p; *p != ']' || p == first; p++) {
+        if (*p == '\0')
+            return -1;                          // no closing ]
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+            if ((unsigned char) p[0] <= (unsigned char) c
+                  && (unsigned char) c <= (unsigned char) p[2])
+                found = TRUE;
+            p += 2;
+        } else if (*p == c) {
+            found = TRUE;
+        }
+    }
+
+    *pat = p + 1;
+    return found != negate;
+}
+
+
+// Does NAME match the pattern PAT?  A * is matched by backing up only to
+// the last * seen, so the time is at most linear in the length of NAME for
+// each character of PAT.
+static int match(const char *pat, const char *name)
+{
+    const char *starPat = NULL,     // pattern after last * seen
+               *starName = NULL;    // where that * started matching
+
+    if (*name == '.' && *pat != '.')
+        return FALSE;                           // hidden file
+
+    while (*name) {
+        const char *next = pat;
+        int ok;
+
+        if (*pat == '*') {
+            starPat = ++pat;
+            starName = name;
+            continue;
+        } else if (*pat == '?') {
+            ok = TRUE;
+            next = pat + 1;
+        } else if (*pat == '[' && (ok = matchClass(&next, *name)) >= 0) {
+            ;
+        } else {
+            ok = (*pat == *name && *pat != '\0');
+            next = pat + 1;
+        }
+
+        if (ok) {
+            pat = next;
+            name++;
+        } else if (starPat) {                   // let * match one more char
+            pat = starPat;
+            name = ++starName;
+        } else {
+            return FALSE;
+        }
+    }
+
+    while (*pat == '*')
+        pat++;
+    return *pat == '\0';
+}
+
+
+static void globPath(char *path, size_t len, const char *pat, wordList *w);
+
+
+// Handle the entry NAME (of type TYPE) in the directory PATH (LEN chars)
+// while matching the component COMP of a pattern followed by REST (NULL if
+// COMP is the last component)
+static void globEntry(char *path, size_t len, const char *comp,
+                      const char *rest, const char *name, int type,
+                      wordList *w)
+{
+    size_t n = strlen(name);
+    struct stat st;
+
+    if (!strcmp(name, ".") || !strcmp(name, "..") || !match(comp, name)
+          || len + n >= PATH_MAX)
+        return;
+
+    memcpy(path + len, name, n + 1);
+    if (rest == NULL) {
+        addWord(w, pushString(path, len + n));
+    } else if (type == DT_DIR
+            || ((type == DT_LNK || type == DT_UNKNOWN)
+                && stat(path, &st) == 0 && S_ISDIR(st.st_mode))) {
+        globPath(path, len + n, rest, w);
+    }
+    path[len] = '\0';
+}
+
+
+// Append entry NAME of type TYPE to listing L
+static void addEntry(listing *l, const char *name, int type)
+{
+    size_t n = strlen(name) + 2;
+
+    if (l->size + n > l->max) {
+        l->max = 2 * l->max + n + 4096;
+        l->names = realloc(l->names, l->max);
+    }
+    l->names[l->size] = type;
+    memcpy(l->names + l->size + 1, name, n - 1);
+    l->size += n;
+}
+
+
+// Match the entries of the directory PATH (LEN chars, "" = current directory)
+// against the component COMP followed by REST.  The listing is taken from the
+// cache if possible; otherwise it is read with getdents64() and added to the
+// cache if it fits.
+static void globDir(char *path, size_t len, const char *comp,
+                    const char *rest, wordList *w)
+{
+    const char *dir = (len > 0) ? path : ".";
+    listing *l;
+    int fd;
+
+    for (l = cache; l; l = l->next) {
+        if (!strcmp(l->dir, dir)) {
+            for (char *p = l->names; p < l->names + l->size; ) {
+                globEntry(path, len, comp, rest, p+1, *p, w);
+                p += strlen(p+1) + 2;
+            }
+            return;
+        }
+    }
+
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        return;                                 // no match
+
+    l = calloc(1, sizeof(*l));
+    l->dir = strdup(dir);
+
+    char *buf = malloc(DENTS_SIZE);
+    ssize_t nread;
+    while ((nread = getdents64(fd, buf, DENTS_SIZE)) > 0) {
+        for (char *p = buf; p < buf + nread; ) {
+            struct dirent64 *d = (struct dirent64 *) p;
+            if (l != NULL) {
+                addEntry(l, d->d_name, d->d_type);
+                if (cacheBytes + l->size > CACHE_MAX) {
+                    free(l->dir);               // too big to cache, so
+                    free(l->names);             //   keep matching without
+                    free(l);                    //   saving the listing
+                    l = NULL;
+                }
+            }
+            globEntry(path, len, comp, rest, d->d_name, d->d_type, w);
+            p += d->d_reclen;
+        }
+    }
+    free(buf);
+    close(fd);
+
+    if (l != NULL && nread == 0) {
+        l->next = cache;
+        cache = l;
+        cacheBytes += l->size;
+    } else if (l != NULL) {
+        free(l->dir);
+        free(l->names);
+        free(l);
+    }
+}
+
+
+// Append to W the pathnames that match the pattern PAT relative to the
+// directory PATH (LEN chars, "" = current directory)
+static void globPath(char *path, size_t len, const char *pat, wordList *w)
+{
+    const char *slash;
+    char comp[NAME_MAX+1];
+    size_t n;
+    struct stat st;
+
+    while (*pat == '/' && len + 1 < PATH_MAX) {         // copy slashes
+        path[len++] = '/';
+        pat++;
+    }
+    path[len] = '\0';
+
+    slash = strchr(pat, '/');
+    n = slash ? (size_t) (slash - pat) : strlen(pat);
+    if (n == 0) {                               // pattern ended with /
+        addWord(w, pushString(path, len));
+        return;
+    } else if (n > NAME_MAX || len + n >= PATH_MAX) {
+        return;
+    }
+    memcpy(comp, pat, n);
+    comp[n] = '\0';
+
+    if (isPattern(comp)) {
+        globDir(path, len, comp, slash, w);
+    } else {                                    // literal component
+        memcpy(path + len, comp, n + 1);
+        if (slash)
+            globPath(path, len + n, slash, w);
+        else if (lstat(path, &st) == 0)
+            addWord(w, pushString(path, len + n));
+        path[len] = '\0';
+    }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Variable expansion and command substitution.  A word is scanned once,
+// recording the pieces of the result (literal text, variable values, and
+// command output) and their total length; the result is then copied into a
+// string of exactly that length.
+
+typedef struct {
+    const char *text;               // start of piece
+    size_t len;                     // length of piece
+    char *output;                   // command output to free (or NULL)
+} piece;
+
+
+char **params = NULL;               // positional parameters
+int nParams = 0;
+
+
+// Return the value of the positional parameter (or #) whose name is the LEN
+// chars at NAME (NULL if unset)
+static const char *param(const char *name, size_t len)
+{
+    static char count[PARAM_DIGITS];
+    size_t i = 0;
+
+    if (*name == '#') {
+        sprintf(count, "%d", nParams);
+        return count;
+    }
+    while (len-- > 0 && i <= nParams)
+        i = 10 * i + (*name++ - '0');
+    return (params != NULL && i <= nParams) ? params[i] : NULL;
+}
+
+
+// Return the value of the variable whose name is the LEN chars at NAME (NULL
+// if unset)
+static const char *lookup(const char *name, size_t len)
+{
+    if (isdigit((unsigned char) *name) || *name == '#')
+        return param(name, len);
+    for (char **e = environ; *e; e++) {
+        if (strncmp(*e, name, len) == 0 && (*e)[len] == '=')
+            return *e + len + 1;
+    }
+    return NULL;
+}
+
+
+// Return the end of the variable name starting at S (S if none); a positional
+// parameter has one digit unless BRACED
+static const char *scanName(const char *s, int braced)
+{
+    if (*s == '?' || *s == '#' || (isdigit((unsigned char) *s) && !braced))
+        return s + 1;
+    else if (isdigit((unsigned char) *s)) {
+        while (isdigit((unsigned char) *s))
+            s++;
+        return s;
+    }
+    if (!isalpha((unsigned char) *s) && *s != '_')
+        return s;
+    while (isalnum((unsigned char) *s) || *s == '_')
+        s++;
+    return s;
+}
+
+
+// Return the } that closes the ${ before S, which ends before END (or NULL)
+static const char *closeBrace(const char *s, const char *end)
+{
+    for (int depth = 0; s < end; s++) {
+        if (s[0] == '$' && s + 1 < end && s[1] == '{') {
+            depth++;
+            s++;
+        } else if (*s == '}' && depth-- == 0) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+
+static char *expandVars(char *word);
+
+
+// Return the value of the arithmetic expression EXPR, after expanding it, as
+// a decimal string on the stack ("" and set failed if it is invalid)
+static char *arithValue(char *expr)
+{
+    long long value;
+    char digits[32];
+
+    if (arith(expandVars(expr), &value) < 0) {
+        failed = TRUE;
+        return "";
+    }
+    return pushString(digits, sprintf(digits, "%lld", value));
+}
+
+
+// Append to PIECES[*N] the pieces of the expansion of the text from S to END
+// and return their total length
+static size_t collect(const char *s, const char *end, piece *pieces, int *n)
+{
+    const char *lit = s;                // start of pending literal text
+    size_t len = 0;
+
+    while (s < end) {
+        const char *name, *nameEnd,     // variable name
+                   *def = NULL,         // default value (if any)
+                   *defEnd = NULL,
+                   *next;               // text after reference
+        const char *value;
+
+        if (*s == SUBST_MARK) {                 // $(COMMAND) or $((EXPRESSION))
+            if (lit < s) {
+                pieces[(*n)++] = (piece) { lit, s - lit, NULL };
+                len += s - lit;
+            }
+            char *expr = substExpr(s, &next);
+            if (expr != NULL) {
+                value = arithValue(expr);
+                pieces[(*n)++] = (piece) { value, strlen(value), NULL };
+            } else {
+                size_t outLen;
+                char *output = runSubst(s, &next, &outLen);
+                pieces[(*n)++] = (piece) { output, outLen, output };
+            }
+            len += pieces[*n - 1].len;
+            s = lit = next;
+            continue;
+        } else if (*s != '$') {
+            s++;
+            continue;
+        }
+
+        if (s[1] == '{') {                      // ${NAME} or ${NAME:-WORD}
+            name = s + 2;
+            nameEnd = scanName(name, TRUE);
+            if (nameEnd > name && *nameEnd == '}') {
+                next = nameEnd + 1;
+            } else if (nameEnd > name && nameEnd[0] == ':' && nameEnd[1] == '-'
+                       && (defEnd = closeBrace(nameEnd + 2, end))) {
+                def = nameEnd + 2;
+                next = defEnd + 1;
+            } else {
+                s++;                            // not a reference
+                continue;
+            }
+        } else {                                // $NAME or $?
+            name = s + 1;
+            if ((nameEnd = scanName(name, FALSE)) == name) {
+                s++;                            // not a reference
+                continue;
+            }
+            next = nameEnd;
+        }
+
+        if (lit < s) {
+            pieces[(*n)++] = (piece) { lit, s - lit, NULL };
+            len += s - lit;
+        }
+        value = lookup(name, nameEnd - name);
+        if (value && *value) {
+            pieces[(*n)++] = (piece) { value, strlen(value), NULL };
+            len += pieces[*n - 1].len;
+        } else if (def) {
+            len += collect(def, defEnd, pieces, n);
+        }
+        s = lit = next;
+    }
+
+    if (lit < end) {
+        pieces[(*n)++] = (piece) { lit, end - lit, NULL };
+        len += end - lit;
+    }
+    return len;
+}
+
+
+// Return WORD with variables and command substitutions expanded (WORD itself
+// if it contains neither)
+static char *expandVars(char *word)
+{
+    int nRefs = 0, n = 0;
+    size_t len;
+    char *result, *r;
+    piece local[LOCAL_PIECES], *pieces = local;
+
+    if (!hasRefs(word))
+        return word;                            // fast path: no copy
+    for (r = word; *r; r++)
+        nRefs += (*r == '$' || *r == SUBST_MARK);
+
+    if (3 * nRefs + 1 > LOCAL_PIECES)           // at most a literal, a value,
+        pieces = malloc((3 * nRefs + 1)         //   and a trailing literal
+                        * sizeof(piece));       //   per reference
+    len = collect(word, word + strlen(word), pieces, &n);
+
+    result = r = push(len + 1);
+    for (int i = 0; i < n; i++) {
+        memcpy(r, pieces[i].text, pieces[i].len);
+        r += pieces[i].len;
+        free(pieces[i].output);
+    }
+    *r = '\0';
+    if (pieces != local)
+        free(pieces);
+    return result;
+}
+
+
+// Compare two words for qsort()
+static int compareWords(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+// Append the expansion of WORD to W (nothing if it expands to an empty
+// string)
+static void expandWord(char *word, wordList *w)
+{
+    char path[PATH_MAX];
+    int first = w->n;
+
+    if ((word = expandVars(word))[0] == '\0') {
+        return;
+    } else if (!isPattern(word)) {
+        addWord(w, word);
+        return;
+    }
+
+    globPath(path, 0, word, w);
+    if (w->n == first)
+        addWord(w, word);                       // no match
+    else
+        qsort(w->words + first, w->n - first, sizeof(char *), compareWords);
+}
+
+
+// Return the expansion of the redirection target FILE (NULL if ambiguous)
+static char *expandFile(char *file, wordList *w)
+{
+    w->n = 0;
+    expandWord(file, w);
+    if (w->n != 1) {
+        fprintf(stderr, "%s: ambiguous redirect\n", file);
+        return NULL;
+    }
+    return w->words[0];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+CMD *expandCMD(CMD *cmd)
+{
+    int first = (cmd->type == FOR_LOOP);        // for NAME is not expanded
+    int i;
+    CMD *exp;
+    wordList w = { 0, 0, NULL };
+
+    for (i = first; i < cmd->argc && !isSpecial(cmd->argv[i]); i++)
+        ;
+    if (i == cmd->argc
+          && (cmd->fromFile == NULL || !isSpecial(cmd->fromFile))
+          && (cmd->toFile == NULL || !isSpecial(cmd->toFile))) {
+        for (i = 0; i < cmd->nLocal && !hasRefs(cmd->locVal[i]); i++)
+            ;
+        if (i == cmd->nLocal)
+            return cmd;                         // nothing to expand
+    }
+
+    exp = push(sizeof(*exp));
+    *exp = *cmd;
+    int outer = failed;                         // (restored for an expansion
+    failed = FALSE;                             //   that called expandCMD())
+
+    if (cmd->nLocal > 0) {
+        exp->locVal = push(cmd->nLocal * sizeof(char *));
+        for (i = 0; i < cmd->nLocal; i++)
+            exp->locVal[i] = expandVars(cmd->locVal[i]);
+    }
+
+    if ((cmd->fromFile && !(exp->fromFile = expandFile(cmd->fromFile, &w)))
+          || (cmd->toFile && !(exp->toFile = expandFile(cmd->toFile, &w)))) {
+        free(w.words);
+        pop(exp);
+        failed = outer;
+        return NULL;
+    }
+
+    w.n = 0;
+    for (i = 0; i < cmd->argc; i++) {
+        if (i < first)
+            addWord(&w, cmd->argv[i]);
+        else
+            expandWord(cmd->argv[i], &w);
+    }
+
+    if (failed) {                               // arithmetic error
+        free(w.words);
+        pop(exp);
+        failed = outer;
+        return NULL;
+    }
+    failed = outer;
+
+    exp->argc = w.n;
+    exp->argv = push((w.n + 1) * sizeof(char *));
+    memcpy(exp->argv, w.words, w.n * sizeof(char *));
+    exp->argv[w.n] = NULL;
+    free(w.words);
+    return exp;
+}
+
+
+void releaseCMD(CMD *exp, CMD *cmd)
+{
+    if (exp != cmd)
+        pop(exp);
+}
@@ -0,0 +1,52 @@
+// expand.h
+//
+// Word expansion for Bsh.  Just before a <stage> (SIMPLE, SUBCMD, FOR_LOOP,
+// or WHILE_LOOP) is executed, its arguments (the WORDs of a for loop),
+// redirection targets, and local variable values are expanded:
+//
+// * Variable expansion.  $NAME and ${NAME} are replaced by the value of the
+//   environment variable NAME (nothing if unset), ${NAME:-WORD} by WORD if
+//   NAME is unset or empty, $? by the status of the last command, and $0
+//   ... $9, ${N}, and $# by the positional parameters of a function call and
+//   their number (see func.h).  The value is not split into words, but a word
+//   that expands to nothing is removed.  A $ that does not begin such a
+//   reference is left unchanged.
+//
+// * Pathname expansion (except for local variable values).  A word that
+//   then contains *, ?, or [ is a pattern; it is replaced by the sorted list
+//   of pathnames that match it (each / separated component is matched
+//   separately, and a leading . must be matched explicitly), or left
+//   unchanged if none match.  A redirection target must expand to exactly one
+//   word.
+//
+// The parsed command is not modified (a loop body is expanded anew on each
+// iteration); instead expandCMD() returns an expanded copy that shares every
+// word that did not need expansion.  Copies are allocated on a stack and must
+// be released in the reverse order of expansion.
+//
+// Directory listings are read with getdents64() in large batches and cached
+// until clearExpandCache() is called (by process() at the end of each command
+// line, and by cd), so that patterns against the same directory read it once.
+
+#ifndef EXPAND_INCLUDED
+#define EXPAND_INCLUDED
+
+#include "parse.h"
+
+// Positional parameters: $0 is PARAMS[0], ..., $N is PARAMS[N], where N is
+// NPARAMS (PARAMS is NULL outside of functions)
+extern char **params;
+extern int nParams;
+
+// Return an expanded copy of the <stage> CMD (or CMD itself if nothing needs
+// expansion) or NULL after printing a message if an expansion failed
+CMD *expandCMD (CMD *cmd);
+
+// Release EXP, the value returned by expandCMD (CMD), and every expansion
+// made after it
+void releaseCMD (CMD *exp, CMD *cmd);
+
+// Forget all cached directory listings
+void clearExpandCache (void);
+
+#endif
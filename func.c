@@ -0,0 +1,86 @@
+// func.c
+//
+// Table of shell functions for Bsh.  See func.h for details.
+
+#include "process-stub.h"
+#include "func.h"
+#include "subst.h"
+
+typedef struct {
+    char *name;
+    CMD *body;
+    int *kept, nKept;               // placeholders in body (see subst.h)
+} func;
+
+static func *funcs = NULL;          // functions defined
+static int nFuncs = 0,              // number of entries used in funcs[]
+           maxFuncs = 0;            // number of entries allocated
+
+
+// Return a copy of the null-terminated vector V
+static char **copyVector(char **v, int n)
+{
+    char **copy = malloc((n + 1) * sizeof(char *));
+
+    for (int i = 0; i < n; i++)
+        copy[i] = strdup(v[i]);
+    copy[n] = NULL;
+    return copy;
+}
+
+
+// Return a copy of the tree of commands rooted at C
+static CMD *copyCMD(CMD *c)
+{
+    if (c == NULL)
+        return NULL;
+
+    CMD *copy = mallocCMD();
+
+    free(copy->argv);
+    *copy = *c;
+    copy->argv = copyVector(c->argv, c->argc);
+    if (c->nLocal > 0) {
+        copy->locVar = copyVector(c->locVar, c->nLocal);
+        copy->locVal = copyVector(c->locVal, c->nLocal);
+    }
+    copy->fromFile = c->fromFile ? strdup(c->fromFile) : NULL;
+    copy->toFile = c->toFile ? strdup(c->toFile) : NULL;
+    copy->left = copyCMD(c->left);
+    copy->right = copyCMD(c->right);
+    return copy;
+}
+
+
+void defineFunc(CMD *def)
+{
+    int i;
+
+    for (i = 0; i < nFuncs && strcmp(funcs[i].name, def->argv[0]) != 0; i++)
+        ;
+    CMD *body = copyCMD(def->left);
+    int nKept, *kept = keepSubst(body, &nKept);
+
+    if (i < nFuncs) {                   // after keepSubst(), since the same
+        freeCMD(funcs[i].body);         //   placeholders may be in both
+        releaseSubst(funcs[i].kept, funcs[i].nKept);
+    } else {
+        if (nFuncs == maxFuncs) {
+            maxFuncs = 2 * maxFuncs + 4;
+            funcs = realloc(funcs, maxFuncs * sizeof(func));
+        }
+        funcs[nFuncs++].name = strdup(def->argv[0]);
+    }
+    funcs[i].body = body;
+    funcs[i].kept = kept;
+    funcs[i].nKept = nKept;
+}
+
+
+CMD *findFunc(const char *name)
+{
+    for (int i = 0; i < nFuncs; i++)
+        if (strcmp(funcs[i].name, name) == 0)
+            return funcs[i].body;
+    return NULL;
+}
@@ -0,0 +1,29 @@
+// func.h
+//
+// Shell functions for Bsh.  Executing a definition NAME ( ) { <command> }
+// (see control.h) stores a copy of the parsed tree for <command> in a table,
+// replacing any earlier definition of NAME, so that the body is never parsed
+// again.  A SIMPLE command whose first word is NAME (checked after the
+// built-ins and before the search of PATH) then executes that tree in the
+// shell itself, with the positional parameters $1, $2, ... (and $#, the number
+// of them, and $0, NAME) set to its remaining words and restored afterwards;
+// variables that the body sets remain set.  The built-in return [N] ends the
+// function with status N (default $?).
+//
+// A call that is backgrounded, has I/O redirection, or is a stage of a
+// pipeline executes the body in a child process instead.  Command
+// substitutions in the body stay valid after the line that defined it until
+// the function is redefined (see keepSubst() in subst.h).
+
+#ifndef FUNC_INCLUDED
+#define FUNC_INCLUDED
+
+#include "parse.h"
+
+// Store a copy of the body of the FUNC_DEF command DEF in the table
+void defineFunc (CMD *def);
+
+// Return the body of the function NAME (NULL if none)
+CMD *findFunc (const char *name);
+
+#endif
@@ -0,0 +1,40 @@
+// io.c
+//
+// Whole-buffer I/O.  See io.h for details.
+
+#include <unistd.h>
+#include <errno.h>
+#include "io.h"
+
+#define TRUE (1)
+#define FALSE (0)
+
+
+int writeAll(int fd, const char *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t m = write(fd, buf, n);
+        if (m < 0 && errno == EINTR)
+            continue;
+        else if (m < 0)
+            return FALSE;
+        buf += m;
+        n -= m;
+    }
+    return TRUE;
+}
+
+
+int readAll(int fd, char *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t m = read(fd, buf, n);
+        if (m < 0 && errno == EINTR)
+            continue;
+        else if (m <= 0)
+            return FALSE;
+        buf += m;
+        n -= m;
+    }
+    return TRUE;
+}
@@ -0,0 +1,18 @@
+// io.h
+//
+// Whole-buffer I/O for the built-ins of Bsh.  read(2) and write(2) may
+// transfer fewer bytes than asked (e.g., to or from a pipe) or fail with
+// EINTR when a signal such as SIGCHLD arrives; these retry until done.
+
+#ifndef IO_INCLUDED
+#define IO_INCLUDED
+
+#include <stddef.h>
+
+// Write the N bytes at BUF to FD; return FALSE on error
+int writeAll (int fd, const char *buf, size_t n);
+
+// Read exactly N bytes from FD into BUF; return FALSE on error or end of file
+int readAll (int fd, char *buf, size_t n);
+
+#endif
@@ -5,56 +5,116 @@
 //
 // Bash version based on bottom-up parse tree.
 // Dumps token list or CMD tree if DUMP_LIST or DUMP_CMD is set.
+//
+// Usage:  Bsh                     Read commands from the standard input
+//         Bsh -c COMMAND          Execute COMMAND and exit with its status
+//         Bsh --serve SOCKET      Execute commands sent to SOCKET (serve.h)
 
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
 #include "getLine.h"
 #include "parse.h"
+#include "control.h"
+#include "serve.h"
+#include "subst.h"
+#include "stats.h"
 
 int main (int argc, char *argv[])
 {
     int nCmd = 1;                   // Command number
     char *line;                     // Initial command line
-    token *list;                    // Linked list of tokens
-    CMD *cmd;                       // Parsed command
-    int process (CMD *);
+    int status;                     // Status of command executed
 
     setenv ("?", "0", 1);           // Initialize $?
+    statsInit ();                   // Initialize counters
+
+    if (argc == 3 && !strcmp (argv[1], "-c")) {         // Bsh -c COMMAND
+	status = runLine (argv[2]);
+	return (status < 0) ? EXIT_FAILURE : status;
+    } else if (argc == 3 && !strcmp (argv[1], "--serve")) {
+	return serve (argv[2]);                         // Bsh --serve SOCKET
+    } else if (argc != 1) {
+	fprintf (stderr, "usage: Bsh [-c COMMAND | --serve SOCKET]\n");
+	return EXIT_FAILURE;
+    }
+
+    int seekable = (lseek (0, 0, SEEK_CUR) >= 0);      // Script file?
 
     for ( ; ; ) {
 	printf ("(%d)$ ", nCmd);                // Prompt for command
 	fflush (stdout);
 	if ((line = getLine (stdin)) == NULL)   // Read line
 	    break;                              //   Break on end of file
+	if (seekable)                           // Discard input read ahead so
+	    fflush (stdin);                     //   that a child that exits
+						//   cannot seek back to it
 
-	list = tokenize (line);                 // Lex line into tokens
+	if (runLine (line) >= 0)                // Execute command
+	    nCmd++;                             // Adjust prompt
 	free (line);
-	if (list == NULL) {
-	    continue;
-	} else if (getenv ("DUMP_LIST")) {      // Dump token list only if
-	    dumpList (list);                    //   environment variable set
-	    printf ("\n");
-	}
+    }
 
-	cmd = parse (list);                     // Parsed command?
-	freeList (list);
-	if (cmd == NULL) {
-	    continue;
-	} else if (getenv ("DUMP_CMD")) {       // Dump command tree only if
-	    dumpTree (cmd, 0);                  //   environment variable set
-	    printf ("\n");
-	}
+    return EXIT_SUCCESS;
+}
 
-	process (cmd);                          // Execute command
-	freeCMD (cmd);                          // Free associated storage
-	nCmd++;                                 // Adjust prompt
 
+static size_t sizeCMD (CMD *c);
+
+
+// Lex and parse the command line LINE; return the command (NULL if LINE was
+// empty or could not be parsed)
+static CMD *parseLine (char *line)
+{
+    char *text;                     // Line with $(...) parsed
+    token *list;                    // Linked list of tokens
+    CMD *cmd;                       // Parsed command
+
+    if ((text = parseSubst (line)) == NULL)
+	return NULL;
+    list = tokenize (text);                     // Lex line into tokens
+    free (text);
+    if (list == NULL) {
+	return NULL;
+    } else if (getenv ("DUMP_LIST")) {          // Dump token list only if
+	dumpList (list);                        //   environment variable set
+	printf ("\n");
     }
 
-    return EXIT_SUCCESS;
+    cmd = parseControl (list);                  // Parsed command?
+    freeList (list);
+    return cmd;
+}
+
+
+// Lex, parse, and execute the command line LINE; return the status of the
+// last command executed or -1 if LINE was empty or could not be parsed
+int runLine (char *line)
+{
+    CMD *cmd;                       // Parsed command
+    int status;                     // Status of command executed
+    int process (CMD *);
+    long long start = statsClock ();
+
+    cmd = parseLine (line);
+    COUNT (lines, 1);
+    COUNT (parse_ns, statsClock () - start);
+    COUNT (parse_bytes, sizeCMD (cmd));
+    if (cmd == NULL) {
+	freeSubst ();
+	return -1;
+    } else if (getenv ("DUMP_CMD")) {           // Dump command tree only if
+	dumpTree (cmd, 0);                      //   environment variable set
+	printf ("\n");
+    }
+
+    status = process (cmd);                     // Execute command
+    freeCMD (cmd);                              // Free associated storage
+    freeSubst ();
+    return status;
 }
 
 
@@ -77,6 +137,8 @@ CMD *mallocCMD (void)
     new->left     = NULL;
     new->right    = NULL;
 
+    COUNT (cmds, 1);
+
     return new;
 }
 
@@ -127,6 +189,15 @@ void dumpSimple (CMD *c, int level)
 
     if (c->type == SIMPLE)
 	dumpArgs (c);
+    else if (c->type == FOR_LOOP) {
+	fprintf (stdout, ",  FOR");
+	dumpArgs (c);
+    } else if (c->type == WHILE_LOOP)
+	fprintf (stdout, ",  WHILE");
+    else if (c->type == FUNC_DEF) {
+	fprintf (stdout, ",  FUNCTION");
+	dumpArgs (c);
+    }
     else if (c->type == PIPE)
 	fprintf (stdout, ",  PIPE");
     else if (c->type == SUBCMD)
@@ -155,6 +226,25 @@ int dumpType (CMD *c, int level)
 	if (c->right != NULL)
 	    fprintf (stdout, "  <simple> HAS RIGHT CHILD");
 
+    } else if (c->type == FOR_LOOP || c->type == WHILE_LOOP) {
+	dumpSimple (c, level);
+	if (c->type == WHILE_LOOP) {
+	    fprintf (stdout, "\nCMD:   ");
+	    type = dumpType (c->left, level+1);
+	    fprintf (stdout, "  %c  do", (type == SEP_BG) ? '&' : ';');
+	}
+	fprintf (stdout, "\nCMD:   ");
+	type = dumpType (c->type == FOR_LOOP ? c->left : c->right, level+1);
+	fprintf (stdout, "  %c  done", (type == SEP_BG) ? '&' : ';');
+	type = SEP_END;
+
+    } else if (c->type == FUNC_DEF) {
+	dumpSimple (c, level);
+	fprintf (stdout, "\nCMD:   ");
+	type = dumpType (c->left, level+1);
+	fprintf (stdout, "  %c  }", (type == SEP_BG) ? '&' : ';');
+	type = SEP_END;
+
     } else if (c->argc > 0
 	    || c->argv == NULL
 	    || c->argv[0] != NULL) {
@@ -265,6 +355,28 @@ void freeCMD (CMD *c)
 }
 
 
+// Return the number of bytes allocated for the tree of commands rooted at *C
+// (not counting malloc() overhead)
+static size_t sizeCMD (CMD *c)
+{
+    size_t size;
+
+    if (!c)
+	return 0;
+
+    size = sizeof(*c) + (c->argc + 1) * sizeof(char *);
+    for (int i = 0; i < c->nLocal; i++)
+	size += 2 * sizeof(char *) + strlen (c->locVar[i]) + 1
+	                           + strlen (c->locVal[i]) + 1;
+    for (char **p = c->argv;  *p;  p++)
+	size += strlen (*p) + 1;
+    size += c->fromFile ? strlen (c->fromFile) + 1 : 0;
+    size += c->toFile ? strlen (c->toFile) + 1 : 0;
+
+    return size + sizeCMD (c->left) + sizeCMD (c->right);
+}
+
+
 // Print list of tokens LIST
 void dumpList (struct token *list)
 {
@@ -304,6 +416,16 @@ void dumpTree (CMD *c, int level)
     } else if (c->type == SUBCMD) {
 	fprintf (stdout, "SUBCMD");
 	dumpRedirect (c);
+    } else if (c->type == FOR_LOOP) {
+	fprintf (stdout, "FOR_LOOP");
+	dumpArgs (c);
+	dumpRedirect (c);
+    } else if (c->type == WHILE_LOOP) {
+	fprintf (stdout, "WHILE_LOOP");
+	dumpRedirect (c);
+    } else if (c->type == FUNC_DEF) {
+	fprintf (stdout, "FUNC_DEF");
+	dumpArgs (c);
     } else if (c->type == PIPE) {
 	fprintf (stdout, "PIPE");
     } else if (c->type == SEP_AND) {
@@ -80,7 +80,13 @@ enum {
       NONE,             // Nontoken: Did not find a token
       ERROR,            // Nontoken: Encountered an error
       PIPE,             // Nontoken: CMD struct for pipeline
-      SUBCMD            // Nontoken: CMD struct for subcommand
+      SUBCMD,           // Nontoken: CMD struct for subcommand
+
+   // Types used by parseControl() et al. (see control.h)
+
+      FOR_LOOP,         // Nontoken: CMD struct for for loop
+      WHILE_LOOP,       // Nontoken: CMD struct for while loop
+      FUNC_DEF          // Nontoken: CMD struct for function definition
 };
 
 
@@ -181,7 +187,8 @@ enum {
 
 typedef struct cmd {
   int type;             // Node type (SIMPLE, PIPE, SEP_AND, SEP_OR,
-			//   SEP_END, SEP_BG, SUBCMD, or NONE)
+			//   SEP_END, SEP_BG, SUBCMD, FOR_LOOP, WHILE_LOOP,
+			//   FUNC_DEF, or NONE)
 
   int nLocal;           // Number of local variable assignments
   char **locVar;        // Array of local variable names and the values to
@@ -1,14 +1,55 @@
-#include "/c/cs323/Hwk5/process-stub.h"
+#include "process-stub.h"
 #include <assert.h>
+#include <ctype.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include "trace.h"
+#include "expand.h"
+#include "builtin.h"
+#include "subst.h"
+#include "stats.h"
+#include "ulimit.h"
+#include "func.h"
+#include "stage.h"
+#include "echo.h"
 
 #define TRUE (1)
 #define FALSE (0)
 #define STATUS_DIGITS (128) // max digits for an exit status
+#define MAX_DURATION (1e9)  // max seconds for timeout (about 31 years)
+#define CAPTURE_SIZE (4096) // initial size of buffer for captureCMD()
 
 // Print error message and die with EXIT_FAILURE
 #define errorExit(reason) perror(reason), exit(errno)
 
 int processInternal(CMD *cmdList, int bg);
+int runStage(CMD *cmdList, int bg);
+int stageCMD(CMD *cmdList, int bg);
+int timeoutCMD(CMD *cmdList);
+int funcCMD(CMD *body, CMD *cmdList);
+
+static struct {                     // time limit on next foreground child
+    int active;                     //   (see timeoutCMD())
+    int sig;                        // signal to send when it expires
+    struct timespec duration,       // time until it expires
+                    killAfter;      // then time until SIGKILL (0 = never)
+} limit;
+
+static int calls = 0,               // number of function calls in progress
+           returning = FALSE,       // executing return (see func.h)?
+           returnStatus;            // status it returns
+
+static struct proc {                // process substitutions open in the shell
+    int fd;                         //   (see subst.h): shell's end of pipe
+    pid_t pid;                      //   child executing COMMAND
+    volatile sig_atomic_t done;     //   reaped by reapZombies()?
+} *procs = NULL;
+static int nProcs = 0,              // number of entries used in procs[]
+           maxProcs = 0,            // number of entries allocated
+           ownProcs = 0;            // first entry opened by the expansion
+                                    //   of the command being executed
 
 
 void reapZombies(int sig)
@@ -18,11 +59,41 @@ void reapZombies(int sig)
     while ((pid = waitpid((pid_t)(-1), &status, WNOHANG)) > 0) {
         status = WIFEXITED(status) ?
                  WEXITSTATUS(status) : 128+WTERMSIG(status);
-        fprintf(stderr, "Completed: %d (%d)\n", pid, status);
+        COUNT(reaped_async, 1);
+        if (TRACING)
+            traceReap(pid, status);
+
+        int j;
+        for (j = 0; j < nProcs && procs[j].pid != pid; j++)
+            ;
+        if (j < nProcs)                 // process substitution, which the
+            procs[j].done = TRUE;       //   shell may wait for
+        else
+            fprintf(stderr, "Completed: %d (%d)\n", pid, status);
     }
     return;
 }
 
+// Block (if BLOCK) or unblock SIGCHLD so that reapZombies() cannot reap a
+// foreground child before the shell waits for it
+void blockChld(int block)
+{
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &chld, NULL);
+}
+
+// Block SIGCHLD like blockChld(TRUE), but save the previous mask in *OLD so
+// that it can be restored
+static void holdChld(sigset_t *old)
+{
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, old);
+}
+
 void setVars(CMD *cmdList)
 {
     for (int i = 0; i < cmdList->nLocal; i++)
@@ -72,11 +143,191 @@ void redirect(CMD *cmdList)
 }
 
 
+// Put a newly forked child in its own process group if a time limit is in
+// effect (in the parent as well as the child, so that the limit can never
+// expire before the group exists)
+void limitChild(pid_t pid)
+{
+    if (limit.active) {
+        setpgid(pid, pid);
+        if (pid == 0)
+            limit.active = FALSE;       // not for the child's own children
+    }
+}
+
+
+// Wait for the child PID and its time limit to expire together: poll a pidfd
+// for PID and a timerfd, signal the process group of PID when the timer
+// expires, and send SIGKILL if it expires again.  Store the status of PID in
+// *STATUS and return the number of expirations.
+static int timedWait(pid_t pid, int *status)
+{
+    int expired = 0;
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct itimerspec when = { .it_value = limit.duration };
+
+    if (pidfd < 0 || timer < 0 || timerfd_settime(timer, 0, &when, NULL) < 0) {
+        perror("timeout");              // wait without a limit
+    } else {
+        struct pollfd fds[2] = { { pidfd, POLLIN, 0 }, { timer, POLLIN, 0 } };
+
+        while (poll(fds, 2, -1) >= 0 || errno == EINTR) {
+            uint64_t n;
+            if (fds[0].revents)                 // PID has exited
+                break;
+            else if (!(fds[1].revents & POLLIN) || read(timer, &n, sizeof(n)) < 0)
+                continue;
+            else if (expired++ > 0) {
+                kill(-pid, SIGKILL);
+            } else {
+                kill(-pid, limit.sig);
+                if (limit.sig != SIGKILL && limit.sig != SIGCONT)
+                    kill(-pid, SIGCONT);        // in case it is stopped
+                when.it_value = limit.killAfter;
+                timerfd_settime(timer, 0, &when, NULL);
+            }
+        }
+    }
+
+    if (pidfd >= 0)
+        close(pidfd);
+    if (timer >= 0)
+        close(timer);
+    waitpid(pid, status, 0);
+    return expired;
+}
+
+
+// Wait for the foreground child PID and return its status (124 if its time
+// limit expired, or 137 if it was then killed)
+int waitChild(pid_t pid)
+{
+    int status, expired = 0;
+    long long start = statsClock();
+
+    if (!limit.active)
+        waitpid(pid, &status, 0);
+    else
+        expired = timedWait(pid, &status);
+    COUNT(wait_ns, statsClock() - start);
+    COUNT(reaped_wait, 1);
+
+    if (expired > 0)
+        return (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL) ?
+               128+SIGKILL : 124;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+}
+
+
+// Does an argument of the SIMPLE command CMDLIST contain /dev/fd/FD (e.g.,
+// the value of a variable set from the word list of an enclosing for loop)?
+static int namesProc(CMD *cmdList, int fd)
+{
+    char name[32], *s;
+    int n = snprintf(name, sizeof(name), "/dev/fd/%d", fd);
+
+    for (int i = 1; i < cmdList->argc; i++)
+        for (s = cmdList->argv[i]; (s = strstr(s, name)) != NULL; s += n)
+            if (!isdigit((unsigned char) s[n]))
+                return TRUE;
+    return FALSE;
+}
+
+
+// Execute the SIMPLE command CMDLIST in a child process (any redirection has
+// already been done) and exit
+void execSimple(CMD *cmdList)
+{
+    CMD *body;
+    char *output;
+    size_t len;
+    int status;
+
+    if ((body = findFunc(cmdList->argv[0])) != NULL) {
+        exit(funcCMD(body, cmdList));
+    } else if ((strcmp(cmdList->argv[0], "echo") == 0
+                || strcmp(cmdList->argv[0], "dirs") == 0)
+               && (status = echoText(cmdList->argc, cmdList->argv,
+                                     &output, &len)) >= 0) {
+        fwrite(output, 1, len, stdout);
+        exit(fflush(stdout) == 0 ? status : EXIT_FAILURE);
+    } else if (strcmp(cmdList->argv[0], "tee") == 0) {
+        COUNT(builtins, 1);
+        exit(teeCMD(cmdList->argc, cmdList->argv));
+    } else if (strcmp(cmdList->argv[0], "read") == 0) {
+        COUNT(builtins, 1);
+        exit(readCMD(cmdList->argc, cmdList->argv, 0));
+    } else if (strcmp(cmdList->argv[0], "bshstat") == 0) {
+        COUNT(builtins, 1);
+        exit(bshstatCMD(cmdList->argc, cmdList->argv));
+    } else if (strcmp(cmdList->argv[0], "ulimit") == 0) {
+        COUNT(builtins, 1);
+        exit(ulimitCMD(cmdList->argc, cmdList->argv));
+    } else if (strcmp(cmdList->argv[0], "timeout") == 0) {
+        CMD timed = *cmdList;           // do not redirect again
+        timed.fromType = timed.toType = NONE;
+        timed.fromFile = timed.toFile = NULL;
+        COUNT(builtins, 1);
+        exit(timeoutCMD(&timed));
+    }
+
+    for (int i = 0; i < nProcs; i++)            // let it open /dev/fd/N
+        if (i >= ownProcs || namesProc(cmdList, procs[i].fd))
+            fcntl(procs[i].fd, F_SETFD, 0);
+
+    COUNT(execs, 1);
+    if (TRACING)
+        traceExec(cmdList->argv);
+    execvp(cmdList->argv[0], cmdList->argv);
+    errorExit(cmdList->argv[0]);                // execvp returned, error
+}
+
+
+// Execute the built-in BUILTIN with the arguments of the SIMPLE command
+// CMDLIST in the shell itself (so that ulimit changes the shell's limits),
+// with the standard output redirected as CMDLIST says while it runs; return
+// its status
+static int redirectBuiltin(int (*builtin)(int, char **), CMD *cmdList)
+{
+    int flags = (cmdList->toType == RED_OUT_APP) ? O_APPEND : O_TRUNC;
+    int fd, saved, status;
+
+    if (cmdList->toType == NONE || cmdList->toFile == NULL)
+        return builtin(cmdList->argc, cmdList->argv);
+
+    if ((fd = open(cmdList->toFile, O_WRONLY | O_CREAT | O_CLOEXEC | flags,
+                   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH)) < 0) {
+        perror(cmdList->toFile);
+        return EXIT_FAILURE;
+    }
+    fflush(stdout);
+    if ((saved = fcntl(1, F_DUPFD_CLOEXEC, 3)) < 0) {
+        perror(cmdList->argv[0]);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    dup2(fd, 1);
+    close(fd);
+    status = builtin(cmdList->argc, cmdList->argv);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    return status;
+}
+
+
 int simpleCMD(CMD *cmdList, int bg)
 {
-    if (strcmp(cmdList->argv[0], "cd") == 0 && !bg) {
+    CMD *body;                      // of function argv[0]
+
+    if (cmdList->argc == 0) {                 // all words expanded to nothing
+        setVars(cmdList);
+        return reportStatus(EXIT_SUCCESS);
+    } else if (strcmp(cmdList->argv[0], "cd") == 0 && !bg) {
         char *path;
 
+        COUNT(builtins, 1);
         setVars(cmdList);
         redirect(cmdList);
 
@@ -92,50 +343,111 @@ int simpleCMD(CMD *cmdList, int bg)
         if (chdir(path) == -1) {
             perror("cd");
             return reportStatus(errno);
-        } else 
-            return reportStatus(EXIT_SUCCESS);
-    } else if (strcmp(cmdList->argv[0], "dirs") == 0 && !bg) {
-        if (cmdList->argc != 1) {
-            fprintf(stderr, "usage: dirs\n");
-            return reportStatus(EXIT_FAILURE);
-        }
-
-        char *path = malloc(sizeof(char) * PATH_MAX);
-
-        if (getcwd(path, PATH_MAX) == NULL) {
-            perror("dirs");
-            free(path);
-            return reportStatus(errno);
         } else {
-            printf("%s\n", path);
-            free(path);
+            clearExpandCache();             // relative paths have changed
             return reportStatus(EXIT_SUCCESS);
         }
+    } else if (strcmp(cmdList->argv[0], "dirs") == 0 && !bg
+               && isEcho(cmdList)) {
+        char *output;
+        size_t len;
+        int status = echoText(cmdList->argc, cmdList->argv, &output, &len);
+
+        fwrite(output, 1, len, stdout);
+        free(output);
+        return reportStatus(status);
     } else if (strcmp(cmdList->argv[0], "wait") == 0 && !bg) {
         if (cmdList->argc != 1) {
             fprintf(stderr, "usage: wait\n");
             return reportStatus(EXIT_FAILURE);
         }
         
-        while (waitpid((pid_t)(-1), NULL, 0) > 0);
+        pid_t pid;
+        int status;
+        long long start = statsClock();
+
+        COUNT(builtins, 1);
+        if (TRACING)
+            traceWaitBegin((pid_t)(-1));
+        while ((pid = waitpid((pid_t)(-1), &status, 0)) > 0) {
+            COUNT(reaped_wait, 1);
+            if (TRACING)
+                traceReap(pid, WIFEXITED(status) ?
+                               WEXITSTATUS(status) : 128+WTERMSIG(status));
+        }
+        COUNT(wait_ns, statsClock() - start);
+        if (TRACING)
+            traceWaitEnd((pid_t)(-1));
         return reportStatus(EXIT_SUCCESS);
 
+    } else if (strcmp(cmdList->argv[0], "read") == 0 && !bg) {
+        int in = 0, status;                 // read from IN, not stdin, so
+                                            //   the shell's is unchanged
+        COUNT(builtins, 1);
+        setVars(cmdList);
+        if (cmdList->fromFile != NULL
+              && (in = open(cmdList->fromFile, O_RDONLY | O_CLOEXEC)) < 0) {
+            perror(cmdList->fromFile);
+            return reportStatus(EXIT_FAILURE);
+        }
+        status = readCMD(cmdList->argc, cmdList->argv, in);
+        if (in != 0)
+            close(in);
+        return reportStatus(status);
+    } else if (strcmp(cmdList->argv[0], "timeout") == 0 && !bg) {
+        COUNT(builtins, 1);
+        return timeoutCMD(cmdList);
+    } else if (strcmp(cmdList->argv[0], "bshstat") == 0 && !bg) {
+        COUNT(builtins, 1);
+        return reportStatus(redirectBuiltin(bshstatCMD, cmdList));
+    } else if (strcmp(cmdList->argv[0], "ulimit") == 0 && !bg) {
+        COUNT(builtins, 1);
+        return reportStatus(redirectBuiltin(ulimitCMD, cmdList));
+    } else if (strcmp(cmdList->argv[0], "return") == 0 && !bg) {
+        char *last = getenv("?");
+
+        COUNT(builtins, 1);
+        if (calls == 0) {
+            fprintf(stderr, "return: not in a function\n");
+            return reportStatus(EXIT_FAILURE);
+        } else if (cmdList->argc > 2) {
+            fprintf(stderr, "usage: return [N]\n");
+            return reportStatus(EXIT_FAILURE);
+        }
+        returnStatus = (cmdList->argc == 2) ? atoi(cmdList->argv[1]) & 0xff
+                                            : (last ? atoi(last) : 0);
+        returning = TRUE;
+        return reportStatus(returnStatus);
+    } else if ((body = findFunc(cmdList->argv[0])) != NULL && !bg
+                 && cmdList->fromType == NONE && cmdList->toType == NONE
+                 && !limit.active) {
+        return funcCMD(body, cmdList);          // else run in a child
     } else {
+        blockChld(TRUE);
+        jobBegin();
         pid_t pid = fork();
         int status;
 
         if (pid < 0) {                               // fork error
             perror(cmdList->argv[0]);
+            jobEnd();
+            blockChld(FALSE);
             return reportStatus(errno);
         }
 
 
         else if (pid == 0) {                         // child process
+            blockChld(FALSE);
+            limitChild(0);
+            jobJoin(0);
+            if (TRACING)
+                traceChild(cmdList);
             setVars(cmdList);
             redirect(cmdList);
             if (strcmp(cmdList->argv[0], "cd") == 0) {
                 char *path;
 
+                COUNT(builtins, 1);
                 if (cmdList->argc == 1)
                     path = getenv("HOME");
                 else if (cmdList->argc == 2)
@@ -149,35 +461,29 @@ int simpleCMD(CMD *cmdList, int bg)
                     errorExit("cd");
                 else
                     exit(EXIT_SUCCESS);
-            } else if (strcmp(cmdList->argv[0], "dirs") == 0) {
-                if (cmdList->argc != 1) {
-                    fprintf(stderr, "usage: dirs\n");
-                    exit(EXIT_FAILURE);
-                }
-
-                char *path = malloc(sizeof(char) * PATH_MAX);
-
-                if (getcwd(path, PATH_MAX) == NULL) {
-                    free(path);
-                    errorExit("dirs");
-                } else {
-                    printf("%s\n", path);
-                    free(path);
-                    exit(EXIT_SUCCESS);
-                }
             } else {
-                execvp(cmdList->argv[0], cmdList->argv);
-                errorExit(cmdList->argv[0]);             // execvp returned, error
+                execSimple(cmdList);
             }
         } else {                                     // parent process
+            limitChild(pid);
+            jobJoin(pid);
+            COUNT(forks, 1);
+            if (TRACING)
+                traceFork(pid);
             if (bg) {
                 fprintf(stderr, "Backgrounded: %d\n", pid);
                 status = 0;
             } else {
-                waitpid(pid, &status, 0);
-                status = WIFEXITED(status) ?
-                         WEXITSTATUS(status) : 128+WTERMSIG(status);
+                if (TRACING)
+                    traceWaitBegin(pid);
+                status = waitChild(pid);
+                if (TRACING) {
+                    traceWaitEnd(pid);
+                    traceReap(pid, status);
+                }
             }
+            jobEnd();
+            blockChld(FALSE);
         }
 
         return reportStatus(status);
@@ -185,34 +491,452 @@ int simpleCMD(CMD *cmdList, int bg)
 }
 
 
+// Execute the function BODY in the shell for the SIMPLE command CMDLIST, with
+// the positional parameters set to its arguments
+int funcCMD(CMD *body, CMD *cmdList)
+{
+    char **outerParams = params;
+    int outerN = nParams, status;
+
+    setVars(cmdList);
+    params = cmdList->argv;
+    nParams = cmdList->argc - 1;
+    calls++;
+    status = processInternal(body, FALSE);
+    calls--;
+    if (returning)
+        status = returnStatus;
+    returning = FALSE;
+    params = outerParams;
+    nParams = outerN;
+    return reportStatus(status);
+}
+
+
+// Convert the duration S (a number of seconds, minutes, hours, or days, as
+// given by an optional suffix s, m, h, or d) to *T; return FALSE if invalid
+static int parseDuration(char *s, struct timespec *t)
+{
+    char *end;
+    double d = strtod(s, &end);
+
+    if (end == s || !(d >= 0))
+        return FALSE;
+    else if (*end == 'm')
+        d *= 60;
+    else if (*end == 'h')
+        d *= 60 * 60;
+    else if (*end == 'd')
+        d *= 24 * 60 * 60;
+    else if (*end != 's' && *end != '\0')
+        return FALSE;
+    if (*end != '\0' && end[1] != '\0')
+        return FALSE;
+
+    if (d > MAX_DURATION)
+        d = MAX_DURATION;
+    t->tv_sec = (time_t) d;
+    t->tv_nsec = (long) ((d - t->tv_sec) * 1e9);
+    return TRUE;
+}
+
+
+// Return the signal named or numbered S (with or without SIG), or -1
+static int parseSignal(char *s)
+{
+    static const struct { char *name; int sig; } signals[] = {
+        { "HUP", SIGHUP },   { "INT", SIGINT },   { "QUIT", SIGQUIT },
+        { "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 },
+        { "ALRM", SIGALRM }, { "TERM", SIGTERM }, { "CONT", SIGCONT },
+        { "STOP", SIGSTOP },
+    };
+
+    if (isdigit((unsigned char) *s)) {
+        int sig = atoi(s);
+        return (sig > 0 && sig < NSIG) ? sig : -1;
+    }
+    if (strncmp(s, "SIG", 3) == 0)
+        s += 3;
+    for (int i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        if (strcmp(s, signals[i].name) == 0)
+            return signals[i].sig;
+    }
+    return -1;
+}
+
+
+// timeout DURATION [-s SIG] [-k KILLAFTER] COMMAND ...
+//
+// Run COMMAND in its own process group and send SIG (default TERM) to the
+// group if it is still running after DURATION (0 = no limit), then KILL after
+// KILLAFTER more (if nonzero).  The status is 124 if the limit expired, 137
+// if the command was then killed, and 125 if the arguments are invalid.  A
+// function is run in a child under the limit; a built-in that must run in
+// the shell itself (e.g., cd or read) cannot be, and the status is 126.
+int timeoutCMD(CMD *cmdList)
+{
+    static const char *inShell[] = {
+        "cd", "read", "wait", "return", "timeout", "ulimit", "bshstat",
+    };
+    char **argv = cmdList->argv;
+    int i, ok = TRUE, timed = FALSE;
+
+    limit.sig = SIGTERM;
+    limit.killAfter = (struct timespec) { 0, 0 };
+    for (i = 1; i < cmdList->argc && ok; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i+1 < cmdList->argc)
+            ok = (limit.sig = parseSignal(argv[++i])) > 0;
+        else if (strcmp(argv[i], "-k") == 0 && i+1 < cmdList->argc)
+            ok = parseDuration(argv[++i], &limit.killAfter);
+        else if (!timed)
+            ok = timed = parseDuration(argv[i], &limit.duration);
+        else
+            break;
+    }
+    if (!ok || !timed || i == cmdList->argc) {
+        fprintf(stderr,
+                "usage: timeout DURATION [-s SIG] [-k KILLAFTER] COMMAND ...\n");
+        return reportStatus(125);
+    }
+
+    for (int j = 0; j < sizeof(inShell) / sizeof(inShell[0]); j++) {
+        if (strcmp(argv[i], inShell[j]) == 0) {
+            fprintf(stderr, "timeout: %s: built-in cannot be timed\n", argv[i]);
+            return reportStatus(126);
+        }
+    }
+
+    CMD command = *cmdList;             // COMMAND ... with the same
+    command.argc -= i;                  //   local variables and redirection
+    command.argv += i;
+    limit.active = (limit.duration.tv_sec > 0 || limit.duration.tv_nsec > 0);
+    int status = simpleCMD(&command, FALSE);
+    limit.active = FALSE;
+    return status;
+}
+
+
 int subCMD(CMD *cmdList, int bg)
 {
+    blockChld(TRUE);
+    jobBegin();
     pid_t pid = fork();
     int status;
 
     if (pid < 0) {                      // fork error
         perror("subcommand");
+        jobEnd();
+        blockChld(FALSE);
         return reportStatus(errno);
     }
 
     else if (pid == 0) {                // child process
+        blockChld(FALSE);
+        jobJoin(0);
+        if (TRACING)
+            traceChild(cmdList);
         redirect(cmdList);
-        exit(processInternal(cmdList->left, FALSE));
+        exit(runStage(cmdList, FALSE));
     } else {                            // parent process
+        jobJoin(pid);
+        COUNT(forks, 1);
+        if (TRACING)
+            traceFork(pid);
         if (bg) {
             fprintf(stderr, "Backgrounded: %d\n", pid);
             status = 0;
         } else {
             signal(SIGCHLD, reapZombies);
-            waitpid(pid, &status, 0);
-            status = WIFEXITED(status) ?
-                     WEXITSTATUS(status):128+WTERMSIG(status);
+            if (TRACING)
+                traceWaitBegin(pid);
+            status = waitChild(pid);
+            if (TRACING) {
+                traceWaitEnd(pid);
+                traceReap(pid, status);
+            }
         }
+        jobEnd();
+        blockChld(FALSE);
     }
 
     return reportStatus(status);
 }
 
+// In a child, close the shell's ends of the process substitutions opened
+// before the first MARK (a value returned by openProcs()), which belong to
+// the parent, and forget them
+static void keepProcs(int mark)
+{
+    for (int i = 0; i < mark; i++)
+        close(procs[i].fd);
+    memmove(procs, procs + mark, (nProcs - mark) * sizeof(*procs));
+    nProcs -= mark;
+    ownProcs = 0;
+}
+
+
+char *captureCMD(CMD *cmdList, int mark, size_t *len)
+{
+    int fd[2];                          // pipe from child's stdout
+    pid_t pid;
+    char *output;
+    size_t size = CAPTURE_SIZE, n = 0;
+    ssize_t m;
+    sigset_t old;
+
+    fflush(stdout);                     // so that the child cannot repeat it
+    holdChld(&old);                     // pipeCMD() may hold it already
+    if (pipe2(fd, O_CLOEXEC) < 0) {
+        perror("$(");
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        return NULL;
+    }
+    COUNT(pipes, 1);
+    jobBegin();
+    if ((pid = fork()) < 0) {
+        perror("$(");
+        close(fd[0]);
+        close(fd[1]);
+        jobEnd();
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        return NULL;
+    }
+
+    else if (pid == 0) {                // child process
+        blockChld(FALSE);
+        jobJoin(0);
+        if (TRACING)
+            traceChild(cmdList);
+        dup2(fd[1], 1);
+        close(fd[0]);
+        close(fd[1]);
+        keepProcs(mark < 0 ? nProcs : mark);
+        exit(mark >= 0 ? stageCMD(cmdList, FALSE)
+                       : processInternal(cmdList, FALSE));
+    }
+
+    jobJoin(pid);                       // parent process
+    COUNT(forks, 1);
+    if (TRACING)
+        traceFork(pid);
+    close(fd[1]);
+    output = malloc(size);
+    while ((m = read(fd[0], output + n, size - n)) != 0) {
+        if (m < 0 && errno == EINTR)
+            continue;
+        else if (m < 0)
+            break;
+        if ((n += m) == size)           // keep room for a null
+            output = realloc(output, size *= 2);
+    }
+    close(fd[0]);
+
+    if (TRACING)
+        traceWaitBegin(pid);
+    int status = waitChild(pid);
+    if (TRACING) {
+        traceWaitEnd(pid);
+        traceReap(pid, status);
+    }
+    jobEnd();
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    *len = n;
+    return output;
+}
+
+
+int openProcs(void)
+{
+    return nProcs;
+}
+
+
+void closeProcs(int mark, int wait)
+{
+    sigset_t old;
+    int status;
+
+    if (nProcs == mark)
+        return;
+    holdChld(&old);                     // so that procs[] cannot change
+    while (nProcs > mark) {
+        struct proc *p = &procs[--nProcs];
+        close(p->fd);
+        if (wait && !p->done && waitpid(p->pid, &status, 0) == p->pid) {
+            COUNT(reaped_wait, 1);
+            if (TRACING)
+                traceReap(p->pid, WIFEXITED(status) ? WEXITSTATUS(status) :
+                                                      128+WTERMSIG(status));
+        }                               // else reapZombies() will report it
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+
+int procCMD(CMD *cmdList, int input)
+{
+    int fd[2];                          // pipe to child's stdin or stdout
+    int end = input ? 0 : 1;            // child's end
+    pid_t pid;
+    sigset_t old;
+
+    fflush(stdout);                     // so that the child cannot repeat it
+    holdChld(&old);
+    if (pipe2(fd, O_CLOEXEC) < 0) {
+        perror(input ? ">(" : "<(");
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        return -1;
+    }
+    jobBegin();
+    if ((pid = fork()) < 0) {
+        perror(input ? ">(" : "<(");
+        close(fd[0]);
+        close(fd[1]);
+        jobEnd();
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        return -1;
+    }
+
+    else if (pid == 0) {                // child process
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        jobJoin(0);
+        if (TRACING && cmdList != NULL)
+            traceChild(cmdList);
+        keepProcs(nProcs);
+        dup2(fd[end], end);
+        close(fd[0]);
+        close(fd[1]);
+        exit(cmdList ? processInternal(cmdList, FALSE) : EXIT_SUCCESS);
+    }
+
+    jobJoin(pid);                       // parent process
+    jobEnd();
+    COUNT(forks, 1);
+    COUNT(pipes, 1);
+    if (TRACING)
+        traceFork(pid);
+    close(fd[end]);
+    if (nProcs == maxProcs) {
+        maxProcs = 2 * maxProcs + 4;
+        procs = realloc(procs, maxProcs * sizeof(*procs));
+    }
+    procs[nProcs++] = (struct proc) { fd[!end], pid, FALSE };
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return fd[!end];
+}
+
+
+struct thread {                         // pipeline stage run on a thread
+    int running;                        // is a thread running it?
+    pthread_t tid;                      // its id
+    CMD *exp;                           // its expansion (or NULL)
+    int procs;                          // openProcs() before expansion
+    int in, out;                        // its stdin and stdout
+};
+
+
+// Start a thread in *T for the stage CMD with standard input IN and output OUT
+// if it is an echo or dirs; return FALSE if it must be forked instead (with
+// its expansion, if any, in T->exp)
+static int startThread(struct thread *t, CMD *cmd, int in, int out)
+{
+    char *output = NULL;
+    size_t len = 0;
+    int status = EXIT_FAILURE;          // if expansion fails, as in a child
+
+    *t = (struct thread) { FALSE, 0, NULL, openProcs(), in, out };
+    if (!isEcho(cmd))
+        return FALSE;
+    if ((t->exp = expandCMD(cmd)) != NULL
+          && (status = echoText(t->exp->argc, t->exp->argv,
+                                &output, &len)) < 0)
+        return FALSE;                   // e.g., echo -e
+    if (startStage(output, len, status, out, &t->tid) != 0) {
+        free(output);
+        return FALSE;
+    }
+    t->running = TRUE;
+    return TRUE;
+}
+
+
+// Close the pipe ends held for the N threads in THREADS (in a child forked
+// for a later stage)
+static void closeThreads(struct thread *threads, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (threads[i].running && threads[i].in != 0)
+            close(threads[i].in);
+        if (threads[i].running && threads[i].out != 1)
+            close(threads[i].out);
+    }
+}
+
+
+// Join the N threads in THREADS for the stages COMMANDS, last first, closing
+// the pipe ends held for each once it is done (so that a stage writing to one
+// that does not read gets EPIPE), and release their expansions; return the
+// status of the last of them that failed, as from waitpid()
+static int joinThreads(struct thread *threads, int n, CMD **commands)
+{
+    int status = EXIT_SUCCESS;
+
+    for (int i = n-1; i >= 0; i--) {
+        if (!threads[i].running)
+            continue;
+        int s = joinStage(threads[i].tid);
+        if (s != EXIT_SUCCESS && status == EXIT_SUCCESS)
+            status = W_EXITCODE(s, 0);
+        if (threads[i].in != 0)
+            close(threads[i].in);
+        if (threads[i].out != 1)
+            close(threads[i].out);
+    }
+
+    for (int i = 0; i < n; i++) {       // release first and all after it
+        if (threads[i].exp != NULL && threads[i].exp != commands[i]) {
+            releaseCMD(threads[i].exp, commands[i]);
+            break;
+        }
+    }
+    return status;
+}
+
+
+// Clean up after a pipe() or fork() error in pipeCMD(), given the N threads
+// in THREADS for the stages COMMANDS, the pids in TABLE of those forked, the
+// read end FDIN of the last pipe, the new pipe FD (NULL if none), and the MARK
+// from openProcs(): close the pipes, join the threads, and wait for the
+// children so that no stage is left behind
+static int pipeError(struct thread *threads, int n, CMD **commands,
+                     pid_t *table, int fdIn, int *fd, int mark)
+{
+    int error = errno, status;
+
+    perror("pipe");
+    if (fdIn != 0)
+        close(fdIn);
+    if (fd != NULL) {
+        close(fd[0]);
+        close(fd[1]);
+    }
+    joinThreads(threads, n, commands);
+    for (int i = 0; i < n; i++) {
+        if (table[i] > 0 && waitpid(table[i], &status, 0) == table[i]) {
+            COUNT(reaped_wait, 1);
+            if (TRACING)
+                traceReap(table[i], WIFEXITED(status) ? WEXITSTATUS(status) :
+                                                        128+WTERMSIG(status));
+        }
+    }
+    closeProcs(mark, TRUE);
+    jobEnd();
+    blockChld(FALSE);
+    return reportStatus(error);
+}
+
+
 int pipeCMD(CMD *cmdList, int bg)
 {
     int args = 0;                  // number of commands in chain
@@ -226,7 +950,11 @@ int pipeCMD(CMD *cmdList, int bg)
 
     int fd[2],                     // read and write file descriptors for pipe
         status,                    // current child status
-        fdIn;                      // read end of last pipe (or original stdin)
+        fdIn,                      // read end of last pipe (or original stdin)
+        forked = 0;                // number of children forked
+
+    for (int i = 0; i < args; i++) // no stage forked yet
+        table[i] = 0;
 
     CMD *commands[args];           // store commands in order of execution
     int index = args - 1;          // index into commands array
@@ -236,14 +964,39 @@ int pipeCMD(CMD *cmdList, int bg)
     }
     commands[index] = itr;
 
+    struct thread threads[args];   // stages run on threads (e.g., echo)
+    int mark = openProcs();        // for substitutions expanded for threads
+
     fdIn = 0;       // remember original stdin
+    fflush(stdout);                 // since threads write to fd 1 directly
+    blockChld(TRUE);
+    jobBegin();                     // one group for all stages
     for(int i = 0; i < args-1; i++) {     // create chain of processes
-        if (pipe(fd) || (pid = fork()) < 0) {       // TODO: error
-            perror("pipe");
-            return reportStatus(errno);
+        if (pipe2(fd, O_CLOEXEC))  // not for $(...) expanded for threads
+            return pipeError(threads, i, commands, table, fdIn, NULL, mark);
+
+        if (startThread(&threads[i], commands[i], fdIn, fd[1])) {
+            COUNT(pipes, 1);
+            table[i] = 0;           // thread holds fdIn and fd[1] open
+            fdIn = fd[0];
+            continue;
+        }
+
+        if ((pid = fork()) < 0) {
+            return pipeError(threads, i+1, commands, table, fdIn, fd, mark);
         }
 
         else if (pid == 0) {        // child process
+            blockChld(FALSE);
+            jobJoin(0);
+            closeThreads(threads, i);
+            if (TRACING)
+                traceChild(commands[i]);
+            ownProcs = threads[i].procs;
+            if (threads[i].exp != NULL)     // already expanded
+                commands[i] = threads[i].exp;
+            else if ((commands[i] = expandCMD(commands[i])) == NULL)
+                exit(EXIT_FAILURE);
             close(fd[0]);           // no reading from new pipe
             if (fdIn != 0) {        // stdin = read[last pipe]
                 dup2(fdIn, 0);
@@ -255,14 +1008,21 @@ int pipeCMD(CMD *cmdList, int bg)
             }
 
             redirect(commands[i]);                    // execute ith command
-            if (commands[i]->type == SIMPLE) {
-                execvp(commands[i]->argv[0], commands[i]->argv);
-                errorExit(commands[i]->argv[0]);      // execvp returned, error
-            } else {                                  // subcommand
-                exit(processInternal(commands[i]->left, bg));
+            if (commands[i]->type == SIMPLE && commands[i]->argc == 0) {
+                exit(EXIT_SUCCESS);
+            } else if (commands[i]->type == SIMPLE) {
+                execSimple(commands[i]);
+            } else {                                  // subcommand or loop
+                exit(runStage(commands[i], bg));
             }
         } else {                    // parent process
+            jobJoin(pid);
+            COUNT(forks, 1);
+            if (TRACING)
+                traceFork(pid);
+            COUNT(pipes, 1);
             table[i] = pid;         // save child pid
+            forked++;
             if (i > 0)              // close read[last pipe]
                 close(fdIn);
             fdIn = fd[0];
@@ -270,40 +1030,75 @@ int pipeCMD(CMD *cmdList, int bg)
         }
     }
 
-    if ((pid = fork()) < 0) {       // create last process
-        perror("pipe");             // pipe error
-        return reportStatus(errno);
+    if (startThread(&threads[args-1], commands[args-1], fdIn, 1)) {
+        table[args-1] = 0;          // last stage runs on a thread
+    }
+
+    else if ((pid = fork()) < 0) {  // create last process
+        return pipeError(threads, args, commands, table, fdIn, NULL, mark);
     }
 
     else if (pid == 0) {            // child process
+        blockChld(FALSE);
+        jobJoin(0);
+        closeThreads(threads, args-1);
+        if (TRACING)
+            traceChild(commands[args-1]);
+        ownProcs = threads[args-1].procs;
+        if (threads[args-1].exp != NULL)    // already expanded
+            commands[args-1] = threads[args-1].exp;
+        else if ((commands[args-1] = expandCMD(commands[args-1])) == NULL)
+            exit(EXIT_FAILURE);
         if (fdIn != 0) {            // stdin = read[last pipe]
             dup2(fdIn, 0);
             close(fdIn);
         }
         redirect(commands[args-1]); // execute ith command
-        if (commands[args-1]->type == SIMPLE) {
-            execvp(commands[args-1]->argv[0], commands[args-1]->argv);
-        } else {                    // subcommand
-            exit(processInternal(commands[args-1]->left, bg));
+        if (commands[args-1]->type == SIMPLE && commands[args-1]->argc == 0) {
+            exit(EXIT_SUCCESS);
+        } else if (commands[args-1]->type == SIMPLE) {
+            execSimple(commands[args-1]);
+        } else {                    // subcommand or loop
+            exit(runStage(commands[args-1], bg));
         }
     } else {                        // parent process
+        jobJoin(pid);
+        COUNT(forks, 1);
+        if (TRACING)
+            traceFork(pid);
         table[args-1] = pid;        // save child pid
+        forked++;
         close(fdIn);                // close read[last pipe]
     }
 
-    int finalStatus = EXIT_SUCCESS;
-    for (int i = 0; i < args; ) {   // wait for children to die
-        pid = waitpid((pid_t)(-1), &status, WNOHANG);
+    long long start = statsClock();
+    int finalStatus = joinThreads(threads, args, commands);
+    if (TRACING)
+        traceWaitBegin((pid_t)(-1));
+    for (int i = 0; i < forked; ) { // wait for children to die
+        if ((pid = waitpid((pid_t)(-1), &status, 0)) < 0)
+            break;                  // no children left
+        COUNT(reaped_wait, 1);
         int j;
         for (j = 0; j < args && table[j] != pid; j++)
             ;
         if (j < args) {             // ignore zombie processes
+            if (TRACING)
+                traceReap(pid, WIFEXITED(status) ? WEXITSTATUS(status) :
+                                                   128+WTERMSIG(status));
             if (status != EXIT_SUCCESS) // child failed
                 finalStatus = status;   // save error status
             i++;
         }
     }
 
+    COUNT(wait_ns, statsClock() - start);
+    if (TRACING)
+        traceWaitEnd((pid_t)(-1));
+    closeProcs(mark, !bg);
+    jobEnd();
+    blockChld(FALSE);
+
     finalStatus = WIFEXITED(finalStatus) ? WEXITSTATUS(finalStatus) :
                                            128+WTERMSIG(finalStatus);
 
@@ -316,21 +1111,31 @@ int andCMD(CMD *cmdList, int bg)
     int status;
 
     if (bg) {
+        jobBegin();
         pid_t pid = fork();
 
         if (pid < 0) {                               // fork error
             perror(cmdList->argv[0]);
+            jobEnd();
             return reportStatus(errno);
         }
 
 
         else if (pid == 0) {                         // child process
+            jobJoin(0);
+            if (TRACING)
+                traceChild(cmdList);
             if (processInternal(cmdList->left, FALSE) == EXIT_SUCCESS)
                 processInternal(cmdList->right, FALSE);
             exit(EXIT_SUCCESS);
         } else {                                     // parent process
+            jobJoin(pid);
+            COUNT(forks, 1);
+            if (TRACING)
+                traceFork(pid);
             fprintf(stderr, "Backgrounded: %d\n", pid);
             status = 0;
+            jobEnd();
         }
 
         return reportStatus(status);
@@ -347,21 +1152,31 @@ int orCMD(CMD *cmdList, int bg)
     int status;
 
     if (bg) {
+        jobBegin();
         pid_t pid = fork();
 
         if (pid < 0) {                               // fork error
             perror(cmdList->argv[0]);
+            jobEnd();
             return reportStatus(errno);
         }
 
 
         else if (pid == 0) {                         // child process
+            jobJoin(0);
+            if (TRACING)
+                traceChild(cmdList);
             if (processInternal(cmdList->left, FALSE) != EXIT_SUCCESS)
                 processInternal(cmdList->right, FALSE);
             exit(EXIT_SUCCESS);
         } else {                                     // parent process
+            jobJoin(pid);
+            COUNT(forks, 1);
+            if (TRACING)
+                traceFork(pid);
             fprintf(stderr, "Backgrounded: %d\n", pid);
             status = 0;
+            jobEnd();
         }
 
         return reportStatus(status);
@@ -394,12 +1209,83 @@ void bgCMD(CMD *cmdList, int root)
 }
 
 
-int processInternal(CMD *cmdList, int bg)
+int forCMD(CMD *cmdList)
+{
+    int status = EXIT_SUCCESS;
+
+    for (int i = 1; i < cmdList->argc && !returning; i++) {
+        setenv(cmdList->argv[0], cmdList->argv[i], 1);
+        status = processInternal(cmdList->left, FALSE);
+    }
+
+    return reportStatus(returning ? returnStatus : status);
+}
+
+int whileCMD(CMD *cmdList)
+{
+    int status = EXIT_SUCCESS;
+
+    while (processInternal(cmdList->left, FALSE) == EXIT_SUCCESS
+             && !returning)
+        status = processInternal(cmdList->right, FALSE);
+
+    return reportStatus(returning ? returnStatus : status);
+}
+
+
+// Execute subcommand, loop, or definition CMDLIST in the current process (any
+// redirection has already been done)
+int runStage(CMD *cmdList, int bg)
+{
+    if (cmdList->type == FUNC_DEF) {
+        defineFunc(cmdList);
+        return reportStatus(EXIT_SUCCESS);
+    } else if (cmdList->type == FOR_LOOP)
+        return forCMD(cmdList);
+    else if (cmdList->type == WHILE_LOOP)
+        return whileCMD(cmdList);
+    else
+        return processInternal(cmdList->left, bg);
+}
+
+
+// Execute the <stage> CMDLIST, whose words have been expanded
+int stageCMD(CMD *cmdList, int bg)
 {
     if (cmdList->type == SIMPLE) {
         return simpleCMD(cmdList, bg);
     } else if (cmdList->type == SUBCMD) {
         return subCMD(cmdList, bg);
+    } else {                                // loop
+        if (bg || cmdList->fromType != NONE || cmdList->toType != NONE)
+            return subCMD(cmdList, bg);     // fork only if necessary
+        return runStage(cmdList, bg);
+    }
+}
+
+
+int processInternal(CMD *cmdList, int bg)
+{
+    if (returning)                          // skip rest of function
+        return returnStatus;
+    else if (cmdList->type == FUNC_DEF)
+        return runStage(cmdList, bg);
+    else if (cmdList->type == SIMPLE || cmdList->type == SUBCMD
+          || cmdList->type == FOR_LOOP || cmdList->type == WHILE_LOOP) {
+        int mark = openProcs();             // for process substitutions
+        CMD *exp = expandCMD(cmdList);
+        int status, outer = ownProcs;
+
+        if (exp == NULL) {                  // expansion error
+            closeProcs(mark, TRUE);
+            return reportStatus(EXIT_FAILURE);
+        }
+        ownProcs = mark;
+        status = stageCMD(exp, bg);
+        ownProcs = outer;
+        releaseCMD(exp, cmdList);
+        closeProcs(mark, !bg);
+        return status;
     } else if (cmdList->type == PIPE) {
         return pipeCMD(cmdList, bg);
     } else if (cmdList->type == SEP_AND) {
@@ -423,7 +1309,9 @@ int processInternal(CMD *cmdList, int bg)
 
 int process(CMD *cmdList)
 {
+    traceInit();
     signal(SIGCHLD, reapZombies);
-    processInternal(cmdList, FALSE);
-    return EXIT_SUCCESS;
+    int status = processInternal(cmdList, FALSE);
+    clearExpandCache();                     // listings last one command line
+    return status;
 }
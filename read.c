@@ -0,0 +1,242 @@
+// read.c
+//
+// The read built-in.  See builtin.h for details.
+//
+// read must not consume any input after the newline, since that belongs to
+// whatever reads the same file next, but reading one byte at a time costs a
+// system call per byte.  Instead the input is read in blocks (about twice
+// the length of the last line, so that a short line does not cost a large
+// copy) and then:
+//
+// * A seekable input is moved back to just after the newline with lseek().
+//
+// * A pipe is peeked at by duplicating its contents into a private pipe with
+//   tee(2), which consumes nothing; exactly the bytes of the line are then
+//   read from the input.
+//
+// * A socket is peeked at with recv(MSG_PEEK).
+//
+// Anything else (e.g., a terminal) is read one byte at a time.
+//
+// Variables are assigned by overwriting the environment strings put there by
+// earlier calls when possible, since setenv() allocates a new string each
+// time (and glibc never frees the old ones).
+
+#include "process-stub.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "builtin.h"
+#include "stats.h"
+#include "io.h"
+
+#define TRUE (1)
+#define FALSE (0)
+
+#define MIN_BLOCK  (256)            // min bytes read at a time
+#define READ_BLOCK (64 * 1024)      // max bytes read at a time
+#define DEFAULT_IFS " \t\n"         // field separators if $IFS is unset
+
+typedef enum { IN_SEEKABLE, IN_PIPE, IN_SOCKET, IN_OTHER } inputKind;
+
+static char *buf = NULL;            // line read (reused by each call)
+static size_t size = 0;             // number of bytes allocated for buf[]
+static size_t block = MIN_BLOCK;    // bytes to read at a time
+static int peek[2] = { -1, -1 };    // private pipe for peeking at pipes
+
+typedef struct {
+    char *entry;                    // "NAME=VALUE" passed to putenv()
+    size_t max;                     // number of bytes allocated for entry
+} var;
+
+static var *vars = NULL;            // variables assigned by read
+static int nVars = 0;               // number of entries used in vars[]
+
+
+// Return the kind of input FD is
+static inputKind kindOf(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return IN_OTHER;
+    else if (S_ISFIFO(st.st_mode) && peek[0] < 0) {
+        if (pipe2(peek, O_CLOEXEC) < 0)
+            return IN_OTHER;
+        COUNT(pipes, 1);
+        return IN_PIPE;
+    } else if (S_ISFIFO(st.st_mode))
+        return IN_PIPE;
+    else if (S_ISSOCK(st.st_mode))
+        return IN_SOCKET;
+    else if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))
+        return IN_SEEKABLE;
+    return IN_OTHER;
+}
+
+
+// Look at up to N of the next bytes of the input FD of kind KIND and copy
+// them to P; return the number copied (0 at end of file, -1 on error).  The
+// bytes are consumed only for an IN_SEEKABLE or IN_OTHER input.
+static ssize_t look(int fd, inputKind kind, char *p, size_t n)
+{
+    ssize_t m;
+
+    do {
+        if (kind == IN_SEEKABLE)
+            m = read(fd, p, n);
+        else if (kind == IN_PIPE)
+            m = tee(fd, peek[1], n, 0);
+        else if (kind == IN_SOCKET)
+            m = recv(fd, p, n, MSG_PEEK);
+        else
+            m = read(fd, p, 1);
+    } while (m < 0 && errno == EINTR);
+
+    if (kind == IN_PIPE && m > 0 && !readAll(peek[0], p, m))
+        return -1;
+    return m;
+}
+
+
+// Consume the first USED of the M bytes at P just returned by look()
+static int consume(int fd, inputKind kind, char *p, size_t used, size_t m)
+{
+    if (kind == IN_SEEKABLE && used < m)
+        return lseek(fd, -(off_t) (m - used), SEEK_CUR) >= 0;
+    else if (kind == IN_PIPE || kind == IN_SOCKET)
+        return readAll(fd, p, used);
+    return TRUE;
+}
+
+
+// Append to buf[] (from offset N) the bytes of FD up to and including the
+// next newline without consuming any input after it; return the new length
+// of buf[] (N at end of file) or -1 on error
+static ssize_t readLine(int fd, size_t n)
+{
+    inputKind kind = kindOf(fd);
+    size_t start = n;
+
+    for ( ; ; ) {
+        if (size - n < READ_BLOCK) {
+            size = 2 * size + READ_BLOCK;
+            buf = realloc(buf, size);
+        }
+
+        ssize_t m = look(fd, kind, buf + n, block);
+        if (m <= 0)
+            return (m < 0) ? -1 : (ssize_t) n;
+
+        char *nl = memchr(buf + n, '\n', m);
+        size_t used = nl ? (size_t) (nl + 1 - (buf + n)) : (size_t) m;
+        if (!consume(fd, kind, buf + n, used, m))
+            return -1;
+        n += used;
+
+        if (nl) {                           // guess the next line's length
+            block = 2 * (n - start);
+            block = (block < MIN_BLOCK) ? MIN_BLOCK
+                  : (block > READ_BLOCK) ? READ_BLOCK : block;
+            return n;
+        } else if (block < READ_BLOCK) {
+            block *= 2;
+        }
+    }
+}
+
+
+// Set the variable NAME to VALUE
+static void setVar(const char *name, const char *value)
+{
+    size_t nameLen = strlen(name),
+           len = nameLen + strlen(value) + 2;
+    int i;
+
+    for (i = 0; i < nVars; i++) {
+        if (strncmp(vars[i].entry, name, nameLen) == 0
+              && vars[i].entry[nameLen] == '=')
+            break;
+    }
+
+    if (i < nVars && vars[i].max >= len
+          && getenv(name) == vars[i].entry + nameLen + 1) {
+        strcpy(vars[i].entry + nameLen + 1, value); // still ours: overwrite
+        return;
+    } else if (i == nVars) {
+        vars = realloc(vars, ++nVars * sizeof(var));
+        vars[i].entry = NULL;
+    }
+
+    var *v = &vars[i];
+    char *old = v->entry;               // no longer in the environment once
+    v->max = 2 * len;                   //   the new entry replaces it
+    v->entry = malloc(v->max);
+    sprintf(v->entry, "%s=%s", name, value);
+    putenv(v->entry);
+    free(old);
+}
+
+
+// Assign the fields of the line LINE to the variables NAMES[0], ...,
+// NAMES[NNAMES-1], the last getting the rest of the line.  Fields are
+// separated by runs of the characters in IFS.  Unless RAW, a backslash
+// quotes the next char (and is removed).  Each field is unquoted in place
+// at the start of LINE, which is safe since setVar() copies it.
+static void assign(char *line, char **names, int nNames, const char *ifs,
+                   int raw)
+{
+    char *r = line;                 // next char to read
+
+    while (*r && strchr(ifs, *r))   // skip leading separators
+        r++;
+
+    for (int i = 0; i < nNames; i++) {
+        char *w = line,             // next char to write (w <= r)
+             *keep = line;          // end of field without trailing separators
+        int last = (i == nNames - 1);
+
+        while (*r && (last || !strchr(ifs, *r))) {
+            int quoted = (*r == '\\' && !raw && r[1]);
+            r += quoted;
+            if (quoted || !strchr(ifs, *r))
+                keep = w + 1;
+            *w++ = *r++;
+        }
+        while (*r && strchr(ifs, *r))
+            r++;
+        *keep = '\0';
+        setVar(names[i], line);
+    }
+}
+
+
+int readCMD(int argc, char **argv, int in)
+{
+    int raw = (argc > 1 && strcmp(argv[1], "-r") == 0);
+    char **names = argv + 1 + raw;
+    int nNames = argc - 1 - raw;
+    static char *reply[] = { "REPLY" };
+    const char *ifs = getenv("IFS") ? getenv("IFS") : DEFAULT_IFS;
+    ssize_t n = 0;
+
+    if (nNames == 0) {
+        names = reply;
+        nNames = 1;
+    }
+
+    for ( ; ; ) {                   // join lines ending with backslash
+        if ((n = readLine(in, n)) < 0) {
+            perror("read");
+            return EXIT_FAILURE;
+        } else if (raw || n < 2 || buf[n-1] != '\n' || buf[n-2] != '\\') {
+            break;
+        }
+        n -= 2;
+    }
+
+    int complete = (n > 0 && buf[n-1] == '\n');
+    buf[complete ? n-1 : n] = '\0';     // there is room for the null
+    assign(buf, names, nNames, ifs, raw);
+    return complete ? EXIT_SUCCESS : EXIT_FAILURE;
+}
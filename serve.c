@@ -0,0 +1,223 @@
+// serve.c
+//
+// Server mode for Bsh.  See serve.h for the protocol.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "serve.h"
+#include "stats.h"
+#include "trace.h"
+#include "ulimit.h"
+
+#define REQUEST_MAX (64 * 1024)     // max length of a command line
+#define NFDS        (3)             // stdin, stdout, and stderr
+
+
+// Receive one request on CONN into LINE (REQUEST_MAX bytes) and any file
+// descriptors attached into FDS[] (-1 if absent); return the length of the
+// request, 0 at end of file, or -1 on error
+static ssize_t receive(int conn, char *line, int fds[NFDS])
+{
+    char control[CMSG_SPACE(NFDS * sizeof(int))];
+    struct iovec iov = { line, REQUEST_MAX - 1 };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    for (int i = 0; i < NFDS; i++)
+        fds[i] = -1;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if ((n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC)) < 0)
+        return -1;
+
+    int kept = 0;                       // descriptors stored in fds[]
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *data = (int *) CMSG_DATA(cmsg);
+            for (int i = 0; i < nfds; i++) {
+                int fd;
+                memcpy(&fd, &data[i], sizeof(int));
+                if (kept < NFDS)
+                    fds[kept++] = fd;
+                else
+                    close(fd);          // so a client cannot fill our table
+            }
+        }
+    }
+
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        fprintf(stderr, "Bsh: request too long\n");
+        for (int i = 0; i < kept; i++)
+            close(fds[i]);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    line[n] = '\0';
+    return n;
+}
+
+
+// Execute LINE in a forked worker whose standard input, output, and error
+// are FDS[]; return its exit status
+static int runWorker(char *line, int fds[NFDS])
+{
+    int status;
+
+    jobBegin();
+    pid_t pid = fork();
+
+    if (pid < 0) {                      // fork error
+        int error = errno;
+        perror("serve");
+        jobEnd();
+        return error;
+    }
+
+    else if (pid == 0) {                // child process
+        jobJoin(0);
+        for (int i = 0; i < NFDS; i++) {
+            if (fds[i] < 0 && (fds[i] = open("/dev/null", O_RDWR)) < 0) {
+                perror("/dev/null");
+                exit(errno);
+            }
+            dup2(fds[i], i);            // fds[i] is close-on-exec
+        }
+        status = runLine(line);
+        exit(status < 0 ? EXIT_FAILURE : status);
+    }
+
+    jobJoin(pid);                       // parent process
+    COUNT(forks, 1);
+    waitpid(pid, &status, 0);
+    COUNT(reaped_wait, 1);
+    jobEnd();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+}
+
+
+// Serve requests on connection CONN until the client closes it
+static void serveClient(int conn)
+{
+    char *line = malloc(REQUEST_MAX);   // command line received
+    char reply[16];                     // exit status as a string
+    int fds[NFDS];                      // descriptors received with line
+    int status;
+
+    while (receive(conn, line, fds) > 0) {
+        status = runWorker(line, fds);
+        for (int i = 0; i < NFDS; i++) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+        }
+
+        int n = sprintf(reply, "%d", status);
+        if (send(conn, reply, n, MSG_NOSIGNAL) < 0)
+            break;
+    }
+
+    free(line);
+}
+
+
+// Remove the socket at ADDR if it is stale (i.e., no server accepts
+// connections on it); return 0 if ADDR is now free, or -1 after printing a
+// message if it names anything else
+static int removeStale(struct sockaddr_un *addr)
+{
+    struct stat st;
+    int sock;
+
+    if (lstat(addr->sun_path, &st) < 0) {
+        if (errno == ENOENT)            // nothing there
+            return 0;
+        perror(addr->sun_path);
+        return -1;
+    } else if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s: exists and is not a socket\n", addr->sun_path);
+        return -1;
+    }
+
+    if ((sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+        perror("socket");
+        return -1;
+    } else if (connect(sock, (struct sockaddr *) addr, sizeof(*addr)) == 0
+                 || errno != ECONNREFUSED) {  // e.g., a stream socket
+        fprintf(stderr, "%s: socket in use\n", addr->sun_path);
+        close(sock);
+        return -1;
+    }
+    close(sock);
+
+    if (unlink(addr->sun_path) < 0) {
+        perror(addr->sun_path);
+        return -1;
+    }
+    return 0;
+}
+
+
+int serve(char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int sock, conn;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+
+    if ((sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    if (removeStale(&addr) < 0)
+        return EXIT_FAILURE;
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0
+          || listen(sock, SOMAXCONN) < 0) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGCHLD, SIG_IGN);           // clients are reaped automatically
+    traceInit();                        // open $BSH_TRACE once for all workers
+
+    for ( ; ; ) {
+        if ((conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                perror("accept");
+            continue;
+        }
+
+        pid_t pid = fork();
+
+        if (pid < 0) {                  // fork error
+            perror("serve");
+        } else if (pid == 0) {          // child process
+            close(sock);
+            signal(SIGCHLD, SIG_DFL);   // workers must be waited for
+            serveClient(conn);
+            exit(EXIT_SUCCESS);
+        }
+        COUNT(forks, 1);                // parent process
+        close(conn);
+    }
+}
@@ -0,0 +1,28 @@
+// serve.h
+//
+// Server mode for Bsh (Bsh --serve SOCKET).  The shell listens on the Unix
+// domain socket SOCKET (type SOCK_SEQPACKET) and serves each client that
+// connects in its own process, so clients are served concurrently.  A socket
+// left at SOCKET by a server that has exited is replaced; any other file
+// there (including the socket of a running server) is an error.
+//
+// Each request is one message containing a command line, to which the client
+// may attach up to three file descriptors (SCM_RIGHTS) that become the
+// standard input, output, and error of the command (any not attached are
+// /dev/null).  The command line is lexed, parsed, and executed in a freshly
+// forked worker, and the reply is one message containing its exit status in
+// decimal ("1" if the line was empty or could not be parsed).  A client may
+// send any number of requests on a connection, one at a time.
+
+#ifndef SERVE_INCLUDED
+#define SERVE_INCLUDED
+
+// Serve command lines sent to the socket PATH; return only on error
+int serve (char *path);
+
+// Lex, parse, and execute the command line LINE; return the status of the
+// last command executed or -1 if LINE was empty or could not be parsed
+// (defined in mainBsh.c)
+int runLine (char *line);
+
+#endif
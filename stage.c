@@ -0,0 +1,55 @@
+// stage.c
+//
+// Pipeline stages run on threads.  See stage.h for details.
+
+#include "process-stub.h"
+#include <stdint.h>
+#include "stage.h"
+#include "io.h"
+
+typedef struct {
+    char *output;                   // output to write (freed when done)
+    size_t len;                     // its length
+    int status;                     // exit status if it is written
+    int out;                        // standard output
+} stage;
+
+
+// Write the output of the stage ARG (which is freed) and return its status
+static void *stageThread(void *arg)
+{
+    stage s = *(stage *) arg;
+    int status = s.status;
+    sigset_t blocked;
+
+    free(arg);
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+
+    if (s.len > 0 && !writeAll(s.out, s.output, s.len))
+        status = (errno == EPIPE) ? 128+SIGPIPE : EXIT_FAILURE;
+    free(s.output);
+    return (void *) (intptr_t) status;
+}
+
+
+int startStage(char *output, size_t len, int status, int out, pthread_t *tid)
+{
+    stage *s = malloc(sizeof(*s));
+    int error;
+
+    *s = (stage) { output, len, status, out };
+    if ((error = pthread_create(tid, NULL, stageThread, s)) != 0)
+        free(s);
+    return error;
+}
+
+
+int joinStage(pthread_t tid)
+{
+    void *status;
+
+    pthread_join(tid, &status);
+    return (int) (intptr_t) status;
+}
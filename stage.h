@@ -0,0 +1,30 @@
+// stage.h
+//
+// Pipeline stages run on threads of Bsh.  A stage of a pipeline that is an
+// echo or dirs (see echo.h) is executed by the shell rather than by a forked
+// child (see pipeCMD() in process.c); all other stages are still forked.  The
+// shell expands the stage and produces its output, and a thread writes that
+// output to the stage's standard output (the write end of the pipe next to
+// it), since the write can block until the next stage reads.  The thread uses
+// write(2) rather than the shell's stdout, so that threads never share a
+// stdio stream, and the shell closes the pipe end once it has joined the
+// thread, so that its number cannot be reused while children are being
+// forked.  SIGPIPE is blocked in the thread, so a write to a pipe whose
+// reader has exited fails with EPIPE (status 128+SIGPIPE) instead of killing
+// the shell.
+
+#ifndef STAGE_INCLUDED
+#define STAGE_INCLUDED
+
+#include <stddef.h>
+#include <pthread.h>
+
+// Start a thread that writes the LEN chars of OUTPUT (which it frees; NULL if
+// none) to the descriptor OUT and then exits with STATUS (or the status of a
+// failed write); store its id in *TID and return 0, or return an error number
+int startStage (char *output, size_t len, int status, int out, pthread_t *tid);
+
+// Wait for the thread TID and return its exit status
+int joinStage (pthread_t tid);
+
+#endif
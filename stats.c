@@ -0,0 +1,107 @@
+// stats.c
+//
+// Counters for Bsh.  See stats.h for details.
+
+#include "process-stub.h"
+#include <stddef.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "stats.h"
+#include "builtin.h"
+
+static bshStats early;              // counters before statsInit()
+bshStats *stats = &early;
+
+static pid_t statsPid;              // pid of shell that called statsInit()
+
+static const struct {
+    const char *name;
+    size_t offset;
+} counters[] = {
+    { "lines",        offsetof(bshStats, lines) },
+    { "cmds",         offsetof(bshStats, cmds) },
+    { "parse_bytes",  offsetof(bshStats, parse_bytes) },
+    { "parse_ns",     offsetof(bshStats, parse_ns) },
+    { "forks",        offsetof(bshStats, forks) },
+    { "execs",        offsetof(bshStats, execs) },
+    { "builtins",     offsetof(bshStats, builtins) },
+    { "pipes",        offsetof(bshStats, pipes) },
+    { "reaped_wait",  offsetof(bshStats, reaped_wait) },
+    { "reaped_async", offsetof(bshStats, reaped_async) },
+    { "wait_ns",      offsetof(bshStats, wait_ns) },
+};
+
+#define N_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+
+// Return a pointer to counter I of *stats
+static long long *counter(int i)
+{
+    return (long long *) ((char *) stats + counters[i].offset);
+}
+
+
+long long statsClock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+void statsPrint(FILE *out)
+{
+    for (int i = 0; i < N_COUNTERS; i++)
+        fprintf(out, "%s=%lld\n", counters[i].name,
+                __atomic_load_n(counter(i), __ATOMIC_RELAXED));
+}
+
+
+// Append the counters to $BSH_STATS when the shell that called statsInit()
+// exits
+static void statsDump(void)
+{
+    char *path = getenv("BSH_STATS");
+    FILE *out;
+
+    if (getpid() != statsPid || path == NULL || *path == '\0')
+        return;
+    if ((out = fopen(path, "a")) == NULL) {
+        perror("BSH_STATS");
+        return;
+    }
+    statsPrint(out);
+    fclose(out);
+}
+
+
+void statsInit(void)
+{
+    bshStats *shared = mmap(NULL, sizeof(bshStats), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (shared != MAP_FAILED) {         // else count in this process only
+        *shared = early;
+        stats = shared;
+    }
+    statsPid = getpid();
+    if (getenv("BSH_STATS") != NULL)
+        atexit(statsDump);
+}
+
+
+int bshstatCMD(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+        for (int i = 0; i < N_COUNTERS; i++)
+            __atomic_store_n(counter(i), 0, __ATOMIC_RELAXED);
+        return EXIT_SUCCESS;
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: bshstat [-r]\n");
+        return EXIT_FAILURE;
+    }
+
+    statsPrint(stdout);
+    fflush(stdout);
+    return EXIT_SUCCESS;
+}
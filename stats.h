@@ -0,0 +1,49 @@
+// stats.h
+//
+// Always-on counters for Bsh, printed by the bshstat built-in (see builtin.h)
+// and, if the environment variable BSH_STATS names a file when the shell
+// starts, appended to that file as NAME=VALUE lines when the shell exits.
+//
+//   lines          command lines parsed
+//   cmds           CMD structs allocated by mallocCMD()
+//   parse_bytes    bytes of CMD trees built by parsing
+//   parse_ns       time spent parsing
+//   forks          child processes created
+//   execs          execvp() calls
+//   builtins       built-in commands run without an exec
+//   pipes          pipes created
+//   reaped_wait    children reaped by a wait for them
+//   reaped_async   children reaped by reapZombies()
+//   wait_ns        time spent blocked waiting for children
+//
+// The counters live in a shared anonymous mapping created by statsInit(), so
+// that the work of forked subshells and pipeline stages is counted as well.
+// Each update is a single relaxed atomic add.
+
+#ifndef STATS_INCLUDED
+#define STATS_INCLUDED
+
+#include <stdio.h>
+
+typedef struct {
+    long long lines, cmds, parse_bytes, parse_ns, forks, execs, builtins,
+              pipes, reaped_wait, reaped_async, wait_ns;
+} bshStats;
+
+extern bshStats *stats;             // counters (valid even before statsInit)
+
+// Add N to the counter FIELD of *stats
+#define COUNT(field, n) \
+    __atomic_fetch_add(&stats->field, (n), __ATOMIC_RELAXED)
+
+// Move the counters to memory shared with children and arrange for them to
+// be written to $BSH_STATS at exit; call before the first fork()
+void statsInit (void);
+
+// Return the time in nanoseconds on a monotonic clock
+long long statsClock (void);
+
+// Print the counters to the stream OUT as NAME=VALUE lines
+void statsPrint (FILE *out);
+
+#endif
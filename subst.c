@@ -0,0 +1,294 @@
+// subst.c
+//
+// Command substitution for Bsh.  See subst.h for details.
+
+#include "process-stub.h"
+#include "control.h"
+#include "expand.h"
+#include "subst.h"
+#include "echo.h"
+
+#define TRUE (1)
+#define FALSE (0)
+
+typedef struct {
+    CMD *cmd;                       // command to execute (NULL if empty)
+    char *expr;                     // or arithmetic expression (see arith.h)
+    char dir;                       // '<' or '>' for process substitution,
+                                    //   '$' otherwise, '\0' if entry is free
+    int refs;                       // number of function bodies using it
+    int line;                       // made for the current command line?
+} subst;
+
+static subst *substs = NULL;        // placeholders
+static int nSubsts = 0,             // number of entries in substs[] (after
+                                    //   the last that is not free)
+           maxSubsts = 0,           // number of entries allocated
+           nFree = 0;               // number of free entries before nSubsts
+
+
+// Return the next $(, <(, or >( at or after S (or NULL if none)
+static char *nextSubst(char *s)
+{
+    for (; *s; s++)
+        if ((*s == '$' || *s == '<' || *s == '>') && s[1] == '(')
+            return s;
+    return NULL;
+}
+
+
+// Return the ) that closes the ( before S (or NULL if none)
+static char *closeParen(char *s)
+{
+    for (int depth = 0; *s; s++) {
+        if (*s == '(')
+            depth++;
+        else if (*s == ')' && depth-- == 0)
+            return s;
+    }
+    return NULL;
+}
+
+
+// Add the command CMD or the expression EXPR to substs[], reusing a free
+// entry if there is one; return its index
+static int addEntry(CMD *cmd, char *expr, char dir)
+{
+    int i = nSubsts;
+
+    if (nFree > 0) {                    // left by a function redefined
+        for (i = 0; substs[i].dir != '\0'; i++)
+            ;
+        nFree--;
+    } else if (nSubsts++ == maxSubsts) {
+        maxSubsts = 2 * maxSubsts + 4;
+        substs = realloc(substs, maxSubsts * sizeof(subst));
+    }
+    substs[i] = (subst) { cmd, expr, dir, 0, TRUE };
+    return i;
+}
+
+
+// Free entry I of substs[]
+static void freeEntry(int i)
+{
+    if (substs[i].cmd != NULL)
+        freeCMD(substs[i].cmd);
+    free(substs[i].expr);
+    substs[i] = (subst) { NULL, NULL, '\0', 0, FALSE };
+    nFree++;
+    while (nSubsts > 0 && substs[nSubsts-1].dir == '\0') {
+        nSubsts--;                      // free entries at the end
+        nFree--;
+    }
+}
+
+
+// Parse the command line TEXT (if !ARITH) or the expression TEXT (if ARITH)
+// into substs[] as a substitution of the kind DIR; return its index, or -1 on
+// error
+static int addSubst(char *text, int arith, char dir)
+{
+    char *line;
+    token *list;
+    CMD *cmd = NULL;
+
+    if ((line = parseSubst(text)) == NULL)
+        return -1;
+    else if (arith)
+        return addEntry(NULL, line, dir);   // evaluated when expanded
+
+    list = tokenize(line);
+    free(line);
+    if (list != NULL) {                 // not empty
+        cmd = parseControl(list);
+        freeList(list);
+        if (cmd == NULL)
+            return -1;
+    }
+    return addEntry(cmd, NULL, dir);
+}
+
+
+char *parseSubst(char *line)
+{
+    char *copy, *s, *start, *close;
+    size_t size;
+    FILE *out = open_memstream(&copy, &size);
+
+    for (s = line; (start = nextSubst(s)) != NULL; s = close + 1) {
+        fwrite(s, 1, start - s, out);
+        if ((close = closeParen(start + 2)) == NULL) {
+            fprintf(stderr, "Bsh: missing ) after %c(\n", *start);
+            break;
+        }
+
+        int arith = (*start == '$' && start[2] == '('   // $((EXPRESSION))
+                     && close[-1] == ')' && closeParen(start + 3) == close - 1);
+        char *last = arith ? close - 1 : close;
+
+        *last = '\0';                   // parse COMMAND or EXPRESSION alone
+        int index = addSubst(start + 2 + arith, arith, *start);
+        *last = ')';
+        if (index < 0)
+            break;
+        fprintf(out, "%c%d%c", SUBST_MARK, index, SUBST_END);
+    }
+
+    if (start == NULL)
+        fputs(s, out);
+    fclose(out);
+    if (start != NULL) {                // error
+        free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+
+void freeSubst(void)
+{
+    for (int i = nSubsts-1; i >= 0; i--) {
+        if (substs[i].dir != '\0' && substs[i].refs == 0)
+            freeEntry(i);
+        else
+            substs[i].line = FALSE;     // kept for a function
+    }
+}
+
+
+static void keepTree(CMD *cmd, int **kept, int *n);
+
+// Keep each entry of substs[] with a placeholder in the string S (NULL if
+// none), and those with placeholders in its command or expression, adding
+// its index to the array *KEPT of *N entries unless it is there already
+static void keepText(const char *s, int **kept, int *n)
+{
+    char *end;
+    int i, j;
+
+    for (; s != NULL && (s = strchr(s, SUBST_MARK)) != NULL; s = end) {
+        i = strtol(s + 1, &end, 10);
+        if (i < 0 || i >= nSubsts || substs[i].dir == '\0')
+            continue;
+        for (j = 0; j < *n && (*kept)[j] != i; j++)
+            ;
+        if (j < *n)                     // already kept
+            continue;
+        *kept = realloc(*kept, (*n + 1) * sizeof(int));
+        (*kept)[(*n)++] = i;
+        substs[i].refs++;
+        keepTree(substs[i].cmd, kept, n);
+        keepText(substs[i].expr, kept, n);
+    }
+}
+
+
+// Keep each entry of substs[] with a placeholder in the tree CMD, as above
+static void keepTree(CMD *cmd, int **kept, int *n)
+{
+    if (cmd == NULL)
+        return;
+    for (int i = 0; i < cmd->argc; i++)
+        keepText(cmd->argv[i], kept, n);
+    for (int i = 0; i < cmd->nLocal; i++)
+        keepText(cmd->locVal[i], kept, n);
+    keepText(cmd->fromFile, kept, n);
+    keepText(cmd->toFile, kept, n);
+    keepTree(cmd->left, kept, n);
+    keepTree(cmd->right, kept, n);
+}
+
+
+int *keepSubst(CMD *cmd, int *n)
+{
+    int *kept = NULL;
+
+    *n = 0;
+    keepTree(cmd, &kept, n);
+    return kept;
+}
+
+
+void releaseSubst(int *kept, int n)
+{
+    for (int j = 0; j < n; j++) {
+        int i = kept[j];
+        if (--substs[i].refs == 0 && !substs[i].line)
+            freeEntry(i);               // else freeSubst() will free it
+    }
+    free(kept);
+}
+
+
+// If the SIMPLE command CMD is echo or dirs, return its output (nothing if
+// its expansion fails, and from a child if the echo on $PATH must be run), or
+// NULL if it is not
+static char *evalBuiltin(CMD *cmd, size_t *len)
+{
+    CMD *exp;
+    char *output = NULL;
+    int mark = openProcs();
+
+    *len = 0;
+    if (!isEcho(cmd))
+        return NULL;
+    else if ((exp = expandCMD(cmd)) == NULL) {
+        closeProcs(mark, TRUE);
+        return strdup("");
+    }
+
+    if (echoText(exp->argc, exp->argv, &output, len) < 0)
+        output = captureCMD(exp, mark, len);    // e.g., echo -e
+    if (output == NULL)                         // e.g., dirs x
+        output = strdup("");
+
+    releaseCMD(exp, cmd);
+    closeProcs(mark, TRUE);
+    return output;
+}
+
+
+// Return the entry for the placeholder at S and set *END to the char after it
+// (NULL if invalid)
+static subst *lookupSubst(const char *s, const char **end)
+{
+    char *e;
+    int i = strtol(s + 1, &e, 10);
+
+    *end = (*e == SUBST_END) ? e + 1 : e;
+    return (i >= 0 && i < nSubsts && substs[i].dir != '\0') ? &substs[i]
+                                                           : NULL;
+}
+
+
+char *substExpr(const char *s, const char **end)
+{
+    subst *entry = lookupSubst(s, end);
+    return entry ? entry->expr : NULL;
+}
+
+
+char *runSubst(const char *s, const char **end, size_t *len)
+{
+    subst *entry = lookupSubst(s, end);
+    CMD *cmd = entry ? entry->cmd : NULL;
+    char *output = NULL;
+    int fd;
+
+    *len = 0;
+    if (entry != NULL && entry->dir != '$') {
+        if ((fd = procCMD(cmd, entry->dir == '>')) < 0)
+            return strdup("");
+        *len = asprintf(&output, "/dev/fd/%d", fd);
+        return output;
+    } else if (cmd != NULL && (output = evalBuiltin(cmd, len)) == NULL)
+        output = captureCMD(cmd, -1, len);
+    if (output == NULL)
+        return strdup("");
+
+    while (*len > 0 && output[*len - 1] == '\n')
+        (*len)--;
+    output[*len] = '\0';
+    return output;
+}
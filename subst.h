@@ -0,0 +1,93 @@
+// subst.h
+//
+// Command substitution for Bsh.  A word may contain $(COMMAND), where COMMAND
+// is a command line (possibly containing further substitutions) whose
+// parentheses balance.  When the word is expanded (see expand.h), $(COMMAND)
+// is replaced by the standard output of COMMAND with any trailing newlines
+// removed.  Like a variable value, the output is not split into words.
+//
+// Since tokenize() would split $(COMMAND) into several tokens, each one is
+// cut out of the command line before it is lexed, parsed once, and replaced
+// by a placeholder: SUBST_MARK, an index into a table of parsed commands, and
+// SUBST_END.  A $((EXPRESSION)) is replaced by a placeholder in the same way
+// (see arith.h), but its entry holds the text of EXPRESSION.  The table lasts
+// until freeSubst() is called at the end of the command line, so a
+// substitution in a loop body is parsed once but executed on every iteration.
+//
+// COMMAND is executed in a forked child, like a subcommand, whose standard
+// output is a pipe that the shell reads into a buffer that doubles in size
+// as needed.  A COMMAND that is a single echo or dirs (with no redirection)
+// is evaluated in the shell itself without forking.
+//
+// Process substitution.  A word may also contain <(COMMAND) or >(COMMAND),
+// which are cut out and parsed in the same way.  When the word is expanded,
+// COMMAND is started in a forked child whose standard output (for <) or
+// input (for >) is a pipe, and <(COMMAND) is replaced by /dev/fd/N, where N
+// is the shell's end of the pipe; so the command that reads or writes the
+// file runs concurrently with COMMAND, and no temporary file is needed.  The
+// shell's ends are close-on-exec except in the command that uses them (see
+// execSimple() in process.c) and are closed once it has been started (or has
+// finished, in the foreground, when the shell also waits for COMMAND).
+
+#ifndef SUBST_INCLUDED
+#define SUBST_INCLUDED
+
+#include <stddef.h>
+#include "parse.h"
+
+#define SUBST_MARK '\002'           // first char of a placeholder
+#define SUBST_END  '\003'           // last char of a placeholder
+
+// Return a copy of the command line LINE (to be freed by the caller) in which
+// each $(COMMAND) and $((EXPRESSION)) has been replaced by a placeholder, or
+// NULL after printing a message if one is unbalanced or a COMMAND cannot be
+// parsed
+char *parseSubst (char *line);
+
+// Free the commands of all placeholders (except those kept)
+void freeSubst (void);
+
+// Keep the placeholders in the tree CMD (the body of a function; see func.h),
+// and those nested in their commands, valid after freeSubst(); return their
+// indices as an array (to be passed to releaseSubst()) of *N entries
+int *keepSubst (CMD *cmd, int *n);
+
+// Release the N placeholders KEPT by keepSubst() (which is freed), freeing
+// those that no other function body uses (at the end of the command line, if
+// they were made for it)
+void releaseSubst (int *kept, int n);
+
+// If the placeholder at S is for $((EXPRESSION)) (see arith.h), return
+// EXPRESSION (which may contain placeholders), else NULL; set *END to the char
+// after the placeholder
+char *substExpr (const char *s, const char **end);
+
+// Execute the command of the placeholder at S and return its output, without
+// trailing newlines, as a string (to be freed by the caller) of length *LEN;
+// set *END to the char after the placeholder
+char *runSubst (const char *s, const char **end, size_t *len);
+
+// Return the number of process substitutions open in the shell (defined in
+// process.c)
+int openProcs (void);
+
+// Close the shell's ends of the process substitutions opened after the first
+// MARK (a value returned by openProcs()) and, if WAIT, wait for their children
+// to exit (defined in process.c)
+void closeProcs (int mark, int wait);
+
+// Start CMDLIST (NULL for an empty command) in a child process, like a
+// subcommand, whose standard output (or input if INPUT) is a pipe, and return
+// the shell's end (or -1 after printing a message on failure) (defined in
+// process.c)
+int procCMD (CMD *cmdList, int input);
+
+// Execute CMDLIST in a child process, like a subcommand, and return its
+// standard output as a string (to be freed by the caller) of length *LEN, or
+// NULL if the child could not be created (defined in process.c).  If MARK is
+// not -1, CMDLIST is a <stage> whose words have already been expanded, and
+// MARK is the value of openProcs() before that expansion.  The child closes
+// the shell's ends of the process substitutions that are not its own.
+char *captureCMD (CMD *cmdList, int mark, size_t *len);
+
+#endif
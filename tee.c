@@ -0,0 +1,217 @@
+// tee.c
+//
+// The tee built-in.  See builtin.h for details.
+//
+// When the standard input is a pipe, each round duplicates the data waiting
+// in it into a private pipe per output with tee(2), which only adds
+// references to the same pages; consumes those data from the standard input
+// by splicing them to /dev/null; and then splices each private pipe to its
+// output.  A splice to a pipe moves page references, and a splice to a file
+// copies in the kernel, so the data never enter user memory.
+
+#include "process-stub.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "builtin.h"
+#include "stats.h"
+#include "io.h"
+
+#define TRUE (1)
+#define FALSE (0)
+
+#define TEE_BUF   (64 * 1024)       // size of buffer for copying
+#define PIPE_SIZE (1024 * 1024)     // requested size of private pipes
+
+
+// Is FD a pipe?
+static int isPipe(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+
+// Move N bytes from the pipe IN to FD, copying through a buffer if FD does
+// not support splice(); return FALSE on error
+static int drain(int in, int fd, size_t n)
+{
+    char buf[TEE_BUF];
+
+    while (n > 0) {
+        ssize_t m = splice(in, NULL, fd, NULL, n, SPLICE_F_MOVE);
+        if (m < 0 && errno == EINTR) {
+            continue;
+        } else if (m < 0 && errno == EINVAL) {  // no splice for FD
+            m = (n < TEE_BUF) ? n : TEE_BUF;
+            if (!readAll(in, buf, m) || !writeAll(fd, buf, m))
+                return FALSE;
+        } else if (m <= 0) {
+            return FALSE;
+        }
+        n -= m;
+    }
+    return TRUE;
+}
+
+
+// Copy the standard input to each of the NFD descriptors FDS[] through a
+// buffer; NAMES[] are used in error messages, and FDS[i] is set to -1 after
+// an error writing it
+static int copyTee(int *fds, char **names, int nfd)
+{
+    char *buf = malloc(TEE_BUF);
+    int status = EXIT_SUCCESS;
+    ssize_t n;
+
+    while ((n = read(0, buf, TEE_BUF)) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            perror("tee");
+            status = EXIT_FAILURE;
+            break;
+        }
+        for (int i = 0; i < nfd; i++) {
+            if (fds[i] >= 0 && !writeAll(fds[i], buf, n)) {
+                perror(names[i]);
+                fds[i] = -1;
+                status = EXIT_FAILURE;
+            }
+        }
+    }
+
+    free(buf);
+    return status;
+}
+
+
+// Copy the standard input (a pipe) to each of the NFD descriptors FDS[]
+// without copying through user memory; NAMES[] are used in error messages,
+// and FDS[i] is set to -1 after an error writing it
+static int spliceTee(int *fds, char **names, int nfd)
+{
+    int mids[nfd][2];               // private pipe for each output
+    size_t got[nfd];                // bytes duplicated into mids[i]
+    int status = EXIT_SUCCESS;
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    char *buf = NULL;               // copy of a round if a tee() fell short
+
+    for (int i = 0; i < nfd; i++) {
+        if (fds[i] >= 0 && pipe2(mids[i], O_CLOEXEC) < 0) {
+            perror("tee");
+            status = EXIT_FAILURE;
+            while (i < nfd)                     // outputs without pipes
+                fds[i++] = -1;
+            goto done;
+        }
+        if (fds[i] >= 0) {
+            COUNT(pipes, 1);
+            fcntl(mids[i][1], F_SETPIPE_SZ, PIPE_SIZE);
+        }
+    }
+
+    for ( ; ; ) {
+        ssize_t n = 0;              // bytes in this round
+        int fellShort = FALSE;      // did some tee() fall short?
+
+        for (int i = 0; i < nfd; i++) {
+            got[i] = 0;
+            if (fds[i] < 0)
+                continue;
+            ssize_t m;
+            while ((m = tee(0, mids[i][1], n ? n : PIPE_SIZE, 0)) < 0
+                    && errno == EINTR)
+                ;
+            if (m < 0) {
+                perror("tee");
+                status = EXIT_FAILURE;
+                goto done;
+            } else if (n == 0) {
+                if ((n = m) == 0)
+                    goto done;                  // end of file
+            } else if (m < n) {
+                fellShort = TRUE;
+            }
+            got[i] = m;
+        }
+
+        if (n == 0) {                           // no outputs are left, so
+            while ((n = splice(0, NULL, null, NULL, PIPE_SIZE, 0)) > 0
+                    || (n < 0 && errno == EINTR))
+                ;                               //   discard the rest
+            goto done;
+        }
+
+        if (fellShort) {                        // keep the round in buf
+            buf = realloc(buf, n);
+            if (!readAll(0, buf, n))
+                goto done;
+        } else if (!drain(0, null, n)) {        // consume the round
+            perror("tee");
+            status = EXIT_FAILURE;
+            goto done;
+        }
+
+        for (int i = 0; i < nfd; i++) {
+            if (fds[i] < 0)
+                continue;
+            if (!drain(mids[i][0], fds[i], got[i])
+                  || (got[i] < (size_t) n
+                      && !writeAll(fds[i], buf + got[i], n - got[i]))) {
+                perror(names[i]);
+                status = EXIT_FAILURE;
+                close(mids[i][0]);
+                close(mids[i][1]);
+                fds[i] = -1;
+            }
+        }
+    }
+
+  done:
+    for (int i = 0; i < nfd; i++) {
+        if (fds[i] >= 0) {
+            close(mids[i][0]);
+            close(mids[i][1]);
+        }
+    }
+    free(buf);
+    close(null);
+    return status;
+}
+
+
+int teeCMD(int argc, char **argv)
+{
+    int append = (argc > 1 && strcmp(argv[1], "-a") == 0);
+    int fds[argc];                  // output descriptors (stdout first)
+    char *names[argc];              // and their names
+    int nfd = 0;
+    int status = EXIT_SUCCESS;
+
+    fds[nfd] = 1;
+    names[nfd++] = "tee: stdout";
+    for (int i = append ? 2 : 1; i < argc; i++) {
+        int fd = open(argv[i],
+                      O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND
+                                                               : O_TRUNC),
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+        if (fd < 0) {
+            perror(argv[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        fds[nfd] = fd;
+        names[nfd++] = argv[i];
+    }
+
+    int live[nfd];                  // outputs without errors so far
+    memcpy(live, fds, sizeof(live));
+    if (isPipe(0))
+        status |= spliceTee(live, names, nfd);
+    else
+        status |= copyTee(live, names, nfd);
+
+    for (int i = 1; i < nfd; i++)
+        close(fds[i]);
+    return status;
+}
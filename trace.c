@@ -0,0 +1,216 @@
+// trace.c
+//
+// Buffered Chrome trace JSON writer for Bsh.  See trace.h for details.
+
+#include "process-stub.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <time.h>
+#include "trace.h"
+
+#define TRACE_BUF   (64 * 1024)     // size of event buffer
+#define EVENT_MAX   (1024)          // max length of one formatted event
+#define NAME_MAX_   (256)           // max length of (escaped) command text
+
+int traceFd = -1;                   // trace file descriptor
+
+static char traceBuf[TRACE_BUF];    // events not yet written
+static size_t traceLen = 0;         // number of bytes in traceBuf
+static pid_t tracePid;              // pid of shell that opened the trace
+
+
+// Write all buffered events with a single write()
+static void traceFlush(void)
+{
+    if (traceLen > 0 && write(traceFd, traceBuf, traceLen) < 0)
+        perror("BSH_TRACE");
+    traceLen = 0;
+}
+
+
+// Flush buffered events at exit; the shell that opened the trace also
+// terminates the JSON array
+static void traceClose(void)
+{
+    if (!TRACING)
+        return;
+
+    if (getpid() == tracePid) {
+        traceLen += sprintf(traceBuf + traceLen,
+                            "{\"name\":\"process_name\",\"ph\":\"M\","
+                            "\"pid\":%d,\"args\":{\"name\":\"Bsh\"}}\n]\n",
+                            tracePid);
+    }
+    traceFlush();
+}
+
+
+void traceInit(void)
+{
+    static bool initialized = false;
+    char *path;
+
+    if (initialized)
+        return;
+    initialized = true;
+
+    if ((path = getenv("BSH_TRACE")) == NULL || *path == '\0')
+        return;
+
+    if ((traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND
+                                      | O_CLOEXEC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
+        perror(path);
+        return;
+    }
+
+    tracePid = getpid();
+    traceBuf[traceLen++] = '[';             // written now so that it precedes
+    traceBuf[traceLen++] = '\n';            //   events flushed by children
+    traceFlush();
+    atexit(traceClose);
+}
+
+
+// Return timestamp in microseconds (CLOCK_MONOTONIC is shared by children)
+static long long traceNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+// Copy at most SIZE-1 bytes of S to DST escaped as a JSON string body
+static void jsonEscape(char *dst, size_t size, const char *s)
+{
+    size_t n = 0;
+
+    for ( ; *s && n + 7 < size; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            dst[n++] = '\\';
+            dst[n++] = c;
+        } else if (c < 0x20) {
+            n += sprintf(dst + n, "\\u%04x", c);
+        } else {
+            dst[n++] = c;
+        }
+    }
+    dst[n] = '\0';
+}
+
+
+// Escape text of argument vector ARGV into DST (SIZE bytes)
+static void argvText(char *dst, size_t size, char **argv)
+{
+    char text[NAME_MAX_];
+    size_t n = 0;
+
+    text[0] = '\0';
+    for (char **p = argv; *p && n + 1 < sizeof(text); p++)
+        n += snprintf(text + n, sizeof(text) - n, p == argv ? "%s" : " %s",
+                      *p);
+    jsonEscape(dst, size, text);
+}
+
+
+// Escape a short description of command CMD into DST (SIZE bytes)
+static void cmdText(char *dst, size_t size, CMD *cmd)
+{
+    if (cmd->type == SIMPLE)
+        argvText(dst, size, cmd->argv);
+    else if (cmd->type == SUBCMD)
+        snprintf(dst, size, "( ... )");
+    else if (cmd->type == PIPE)
+        snprintf(dst, size, "pipeline");
+    else if (cmd->type == FOR_LOOP)
+        snprintf(dst, size, "for %.64s", cmd->argv[0]);
+    else if (cmd->type == WHILE_LOOP)
+        snprintf(dst, size, "while");
+    else if (cmd->type == FUNC_DEF)
+        snprintf(dst, size, "%.64s ( )", cmd->argv[0]);
+    else
+        snprintf(dst, size, "&");       // backgrounded && or ||
+}
+
+
+// Append one event; FMT gives the fields that follow "ts" and "pid".
+// SIGCHLD is blocked so that reapZombies() cannot interleave an event.
+static void traceEvent(const char *fmt, ...)
+{
+    sigset_t chld, old;
+    va_list ap;
+    int n;
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+
+    if (traceLen + EVENT_MAX > TRACE_BUF)
+        traceFlush();
+
+    traceLen += sprintf(traceBuf + traceLen, "{\"ts\":%lld,\"pid\":%d,",
+                        traceNow(), tracePid);
+    va_start(ap, fmt);
+    n = vsnprintf(traceBuf + traceLen, EVENT_MAX - 64, fmt, ap);
+    va_end(ap);
+    traceLen += (n < EVENT_MAX - 64) ? n : EVENT_MAX - 65;   // truncated?
+    traceBuf[traceLen++] = '}';
+    traceBuf[traceLen++] = ',';
+    traceBuf[traceLen++] = '\n';
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+
+void traceFork(pid_t pid)
+{
+    traceEvent("\"tid\":%d,\"ph\":\"i\",\"s\":\"t\",\"name\":\"fork\","
+               "\"args\":{\"child\":%d}", getpid(), pid);
+}
+
+
+void traceChild(CMD *cmd)
+{
+    char name[NAME_MAX_];
+
+    traceLen = 0;
+    cmdText(name, sizeof(name), cmd);
+    traceEvent("\"tid\":%d,\"ph\":\"B\",\"name\":\"%s\","
+               "\"args\":{\"pid\":%d,\"ppid\":%d,\"cmd\":\"%s\"}",
+               getpid(), name, getpid(), getppid(), name);
+}
+
+
+void traceExec(char **argv)
+{
+    char name[NAME_MAX_];
+
+    argvText(name, sizeof(name), argv);
+    traceEvent("\"tid\":%d,\"ph\":\"i\",\"s\":\"t\",\"name\":\"exec\","
+               "\"args\":{\"pid\":%d,\"ppid\":%d,\"cmd\":\"%s\"}",
+               getpid(), getpid(), getppid(), name);
+    traceFlush();
+}
+
+
+void traceWaitBegin(pid_t pid)
+{
+    traceEvent("\"tid\":%d,\"ph\":\"B\",\"name\":\"wait\","
+               "\"args\":{\"for\":%d}", getpid(), pid);
+}
+
+
+void traceWaitEnd(pid_t pid)
+{
+    traceEvent("\"tid\":%d,\"ph\":\"E\",\"name\":\"wait\","
+               "\"args\":{\"for\":%d}", getpid(), pid);
+}
+
+
+void traceReap(pid_t pid, int status)
+{
+    traceEvent("\"tid\":%d,\"ph\":\"E\",\"args\":{\"status\":%d}",
+               pid, status);
+}
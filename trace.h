@@ -0,0 +1,45 @@
+// trace.h
+//
+// Timeline tracing for Bsh.  If the environment variable BSH_TRACE names a
+// file when the first command is processed, every fork, exec, wait, and reap
+// is recorded there as an event in Chrome trace JSON (array) format, which
+// can be loaded into chrome://tracing or ui.perfetto.dev.
+//
+// Each child gets its own row (tid = child pid) spanning fork to reap; waits
+// appear as slices on the row of the shell doing the waiting.  Events are
+// buffered and written with a single write() so that the shell and its
+// children can share the file.  When tracing is disabled every hook costs a
+// single test of traceFd.
+
+#ifndef TRACE_INCLUDED
+#define TRACE_INCLUDED
+
+#include <sys/types.h>
+
+struct cmd;
+
+extern int traceFd;                 // Trace file descriptor or -1 (disabled)
+
+#define TRACING (traceFd >= 0)      // Should hooks be called?
+
+// Open the trace file named by $BSH_TRACE (only the first call does anything)
+void traceInit (void);
+
+// In the parent after fork(): record the fork of child PID
+void traceFork (pid_t pid);
+
+// In the child after fork(): drop events inherited from the parent's buffer
+// and open the row for the child, which is running command CMD
+void traceChild (struct cmd *cmd);
+
+// In the child just before execvp(): record the exec and flush the buffer
+void traceExec (char **argv);
+
+// Record the start and end of a blocking wait for PID (-1 = any child)
+void traceWaitBegin (pid_t pid);
+void traceWaitEnd (pid_t pid);
+
+// Record that child PID was reaped with exit status STATUS (as for $?)
+void traceReap (pid_t pid, int status);
+
+#endif
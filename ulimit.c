@@ -0,0 +1,386 @@
+// ulimit.c
+//
+// The ulimit built-in and the limits it records.  See ulimit.h and builtin.h
+// for details.
+
+#include "process-stub.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "builtin.h"
+#include "ulimit.h"
+
+#define TRUE (1)
+#define FALSE (0)
+
+#define CG_MEMORY  (-1)             // pseudo-resource for memory.max
+#define CG_CPU     (-2)             // pseudo-resource for cpu.max
+#define CPU_PERIOD (100000)         // period for cpu.max (microseconds)
+#define CG_VALUE   (64)             // max chars in a value written to a group
+
+static const struct resource {
+    char opt;                       // option letter
+    int which;                      // RLIMIT_* or CG_*
+    rlim_t unit;                    // bytes (etc.) per unit of value
+    const char *name;
+} resources[] = {
+    { 'c', RLIMIT_CORE,    512,  "core file size (blocks)" },
+    { 'd', RLIMIT_DATA,    1024, "data seg size (kbytes)" },
+    { 'f', RLIMIT_FSIZE,   512,  "file size (blocks)" },
+    { 'l', RLIMIT_MEMLOCK, 1024, "max locked memory (kbytes)" },
+    { 'n', RLIMIT_NOFILE,  1,    "open files" },
+    { 's', RLIMIT_STACK,   1024, "stack size (kbytes)" },
+    { 't', RLIMIT_CPU,     1,    "cpu time (seconds)" },
+    { 'u', RLIMIT_NPROC,   1,    "max user processes" },
+    { 'v', RLIMIT_AS,      1024, "virtual memory (kbytes)" },
+    { 'M', CG_MEMORY,      1024, "job memory.max (kbytes)" },
+    { 'C', CG_CPU,         1,    "job cpu.max (% of a cpu)" },
+};
+
+#define N_RESOURCES (sizeof(resources) / sizeof(resources[0]))
+#define DEFAULT     (2)             // index of -f
+
+static struct {
+    int soft, hard;                 // is soft/hard limit set?
+    struct rlimit lim;              // values in bytes (etc.)
+} limits[N_RESOURCES];
+
+static int inJob = FALSE;           // in a child of a job (so no new groups)?
+static int parentDir = -1;          // descriptor for $BSH_CGROUP
+static int group = -1;              // descriptor for group of current job
+static int depth = 0;               // jobBegin() calls not yet ended
+static char **groups = NULL;        // names of groups not yet removed
+static int nGroups = 0;
+static unsigned long jobs = 0;      // number of groups created
+static pid_t owner;                 // pid of shell that created groups
+
+
+// Is a cgroup limit set?
+static int cgroupLimits(void)
+{
+    for (int i = 0; i < N_RESOURCES; i++)
+        if (resources[i].which < 0 && limits[i].soft)
+            return TRUE;
+    return FALSE;
+}
+
+
+// Open $BSH_CGROUP if not already open; return FALSE after printing a message
+// on failure
+static int openParent(void)
+{
+    char *path = getenv("BSH_CGROUP");
+
+    if (parentDir >= 0)
+        return TRUE;
+    if (path == NULL || *path == '\0') {
+        fprintf(stderr, "ulimit: BSH_CGROUP is not set\n");
+        return FALSE;
+    }
+    if ((parentDir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        perror(path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+// Write the string TEXT to the file NAME in the directory DIR; return FALSE
+// (with errno set) on failure
+static int writeAt(int dir, const char *name, const char *text)
+{
+    int fd = openat(dir, name, O_WRONLY | O_CLOEXEC);
+    int ok = (fd >= 0 && write(fd, text, strlen(text)) >= 0);
+    int saved = errno;
+
+    if (fd >= 0)
+        close(fd);
+    errno = saved;
+    return ok;
+}
+
+
+// Make sure that the controller NAME is enabled for the groups under
+// $BSH_CGROUP; return FALSE after printing a message on failure
+static int enableController(const char *name)
+{
+    char enable[CG_VALUE], controllers[BUFSIZ], *word;
+    int fd;
+    ssize_t n = -1;
+
+    if (!openParent())
+        return FALSE;
+    if ((fd = openat(parentDir, "cgroup.subtree_control",
+                     O_RDONLY | O_CLOEXEC)) >= 0) {
+        n = read(fd, controllers, sizeof(controllers) - 1);
+        close(fd);
+    }
+    if (n < 0) {
+        perror("ulimit: BSH_CGROUP");
+        return FALSE;
+    }
+    controllers[n] = '\0';
+    for (word = strtok(controllers, " \n"); word; word = strtok(NULL, " \n"))
+        if (strcmp(word, name) == 0)
+            return TRUE;
+
+    snprintf(enable, sizeof(enable), "+%s", name);
+    if (!writeAt(parentDir, "cgroup.subtree_control", enable)) {
+        fprintf(stderr, "ulimit: cannot enable %s controller: %s\n",
+                name, strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+// Remove the groups whose jobs have exited
+static void pruneGroups(void)
+{
+    int n = 0;
+
+    if (getpid() != owner)
+        return;
+    for (int i = 0; i < nGroups; i++) {
+        if (unlinkat(parentDir, groups[i], AT_REMOVEDIR) == 0
+              || errno == ENOENT)
+            free(groups[i]);
+        else                            // still in use
+            groups[n++] = groups[i];
+    }
+    nGroups = n;
+}
+
+
+// Write the value of the cgroup limit I to TEXT
+static void cgroupValue(int i, char *text)
+{
+    rlim_t value = limits[i].lim.rlim_cur;
+
+    if (resources[i].which == CG_MEMORY && value == RLIM_INFINITY)
+        strcpy(text, "max");
+    else if (resources[i].which == CG_MEMORY)
+        snprintf(text, CG_VALUE, "%llu", (unsigned long long) value);
+    else if (value == RLIM_INFINITY)
+        snprintf(text, CG_VALUE, "max %d", CPU_PERIOD);
+    else
+        snprintf(text, CG_VALUE, "%llu %d",
+                 (unsigned long long) value * CPU_PERIOD / 100, CPU_PERIOD);
+}
+
+
+void jobBegin(void)
+{
+    char name[NAME_MAX], value[CG_VALUE];
+
+    if (depth++ > 0)                    // e.g., a $(...) expanded for a job
+        return;                         //   joins the job's group
+    else if (inJob || !cgroupLimits() || !openParent())
+        return;
+
+    snprintf(name, sizeof(name), "bsh-%d-%lu", getpid(), ++jobs);
+    if (mkdirat(parentDir, name, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH
+                                         | S_IXOTH) < 0
+          || (group = openat(parentDir, name,
+                             O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        perror("ulimit: job group");        // run the job without one
+        unlinkat(parentDir, name, AT_REMOVEDIR);
+        return;
+    }
+    if (owner == 0) {
+        owner = getpid();
+        atexit(pruneGroups);
+    }
+    groups = realloc(groups, (nGroups + 1) * sizeof(*groups));
+    groups[nGroups++] = strdup(name);
+
+    for (int i = 0; i < N_RESOURCES; i++) {
+        const char *file = (resources[i].which == CG_MEMORY) ? "memory.max"
+                                                              : "cpu.max";
+        if (resources[i].which >= 0 || !limits[i].soft)
+            continue;
+        cgroupValue(i, value);
+        if (!writeAt(group, file, value))
+            perror(file);
+    }
+}
+
+
+void jobJoin(pid_t pid)
+{
+    char text[CG_VALUE];
+
+    if (pid > 0) {                      // parent process
+        snprintf(text, sizeof(text), "%d", pid);
+        if (group >= 0)
+            writeAt(group, "cgroup.procs", text);
+        return;
+    }
+
+    if (group >= 0) {                   // before -n can get in the way
+        if (!writeAt(group, "cgroup.procs", "0"))
+            perror("ulimit: job group");
+        close(group);
+        group = -1;
+    }
+    if (parentDir >= 0) {
+        close(parentDir);
+        parentDir = -1;
+    }
+    inJob = TRUE;                       // so no new groups
+    depth = 0;
+
+    for (int i = 0; i < N_RESOURCES; i++) {
+        struct rlimit lim;
+        int which = resources[i].which;
+
+        if (which < 0 || !(limits[i].soft || limits[i].hard))
+            continue;
+        getrlimit(which, &lim);
+        if (limits[i].hard)
+            lim.rlim_max = limits[i].lim.rlim_max;
+        if (limits[i].soft)
+            lim.rlim_cur = limits[i].lim.rlim_cur;
+        if (setrlimit(which, &lim) < 0)
+            perror("ulimit");
+    }
+}
+
+
+void jobEnd(void)
+{
+    if (--depth > 0)
+        return;
+    if (group >= 0) {
+        close(group);
+        group = -1;
+    }
+    if (nGroups > 0)
+        pruneGroups();
+}
+
+
+// Return the soft (or hard if HARD) limit I for jobs
+static rlim_t current(int i, int hard)
+{
+    struct rlimit lim;
+
+    if (hard ? limits[i].hard : limits[i].soft)
+        return hard ? limits[i].lim.rlim_max : limits[i].lim.rlim_cur;
+    else if (resources[i].which < 0 || getrlimit(resources[i].which, &lim) < 0)
+        return RLIM_INFINITY;
+    return hard ? lim.rlim_max : lim.rlim_cur;
+}
+
+
+// Print the soft (or hard if HARD) limit I for jobs, preceded by its name if
+// NAMED
+static void printLimit(int i, int hard, int named)
+{
+    rlim_t value = current(i, hard);
+
+    if (named)
+        printf("%-28s (-%c) ", resources[i].name, resources[i].opt);
+    if (value == RLIM_INFINITY)
+        printf("unlimited\n");
+    else
+        printf("%llu\n", (unsigned long long) (value / resources[i].unit));
+}
+
+
+// Convert the limit S for the resource I to *VALUE; return FALSE if invalid
+static int parseLimit(int i, const char *s, rlim_t *value)
+{
+    char *end;
+    unsigned long long n;
+
+    if (strcmp(s, "unlimited") == 0) {
+        *value = RLIM_INFINITY;
+        return TRUE;
+    } else if (!isdigit((unsigned char) *s)) {
+        return FALSE;
+    }
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    if (errno != 0 || *end != '\0'
+          || n >= RLIM_INFINITY / resources[i].unit
+          || (resources[i].which == CG_CPU && n == 0))
+        return FALSE;
+    *value = n * resources[i].unit;
+    return TRUE;
+}
+
+
+int ulimitCMD(int argc, char **argv)
+{
+    int soft = FALSE, hard = FALSE, all = FALSE, bad = FALSE, r = DEFAULT, i;
+    rlim_t value;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        for (char *opt = argv[i] + 1; *opt != '\0'; opt++) {
+            if (*opt == 'S') {
+                soft = TRUE;
+            } else if (*opt == 'H') {
+                hard = TRUE;
+            } else if (*opt == 'a') {
+                all = TRUE;
+            } else {
+                for (r = 0; r < N_RESOURCES && resources[r].opt != *opt; r++)
+                    ;
+                bad |= (r == N_RESOURCES);
+            }
+        }
+    }
+    if (bad || i < argc - 1 || (all && i < argc)) {
+        fprintf(stderr, "usage: ulimit [-SH] [-a | -cdflnstuvMC] [LIMIT]\n");
+        return EXIT_FAILURE;
+    }
+
+    if (all) {
+        for (r = 0; r < N_RESOURCES; r++)
+            printLimit(r, hard && !soft, TRUE);
+        fflush(stdout);
+        return EXIT_SUCCESS;
+    } else if (i == argc) {
+        printLimit(r, hard && !soft, FALSE);
+        fflush(stdout);
+        return EXIT_SUCCESS;
+    }
+
+    if (!parseLimit(r, argv[i], &value)) {
+        fprintf(stderr, "ulimit: %s: invalid limit\n", argv[i]);
+        return EXIT_FAILURE;
+    }
+    if (!soft && !hard)
+        soft = hard = TRUE;
+
+    if (resources[r].which < 0) {       // one value for the whole job
+        if (value != RLIM_INFINITY
+              && !enableController(resources[r].which == CG_MEMORY ? "memory"
+                                                                     : "cpu"))
+            return EXIT_FAILURE;
+        limits[r].soft = (value != RLIM_INFINITY);
+        limits[r].lim.rlim_cur = value;
+        return EXIT_SUCCESS;
+    }
+
+    struct rlimit lim = { current(r, FALSE), current(r, TRUE) }, shell;
+    if (soft)
+        lim.rlim_cur = value;
+    if (hard)
+        lim.rlim_max = value;
+    getrlimit(resources[r].which, &shell);
+    if (lim.rlim_cur > lim.rlim_max) {
+        fprintf(stderr, "ulimit: soft limit exceeds hard limit\n");
+        return EXIT_FAILURE;
+    } else if (lim.rlim_max > shell.rlim_max && geteuid() != 0) {
+        fprintf(stderr, "ulimit: %s\n", strerror(EPERM));
+        return EXIT_FAILURE;
+    }
+
+    limits[r].soft |= soft;
+    limits[r].hard |= hard;
+    limits[r].lim = lim;
+    return EXIT_SUCCESS;
+}
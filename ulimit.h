@@ -0,0 +1,44 @@
+// ulimit.h
+//
+// Resource limits on the jobs that Bsh runs.  The ulimit built-in (see
+// builtin.h) records limits in the shell without applying them to the shell
+// itself, so that a runaway job cannot slow down the shell or its other jobs.
+// They are applied in each child forked for a job instead:
+//
+// * Resource limits (-c, -d, -f, -l, -n, -s, -t, -u, -v) are set with
+//   setrlimit(2) in the child, and so apply to each process of the job.
+//
+// * The cgroup limits (-M for memory.max and -C for cpu.max) apply to the job
+//   as a whole.  If either is set, the shell creates a cgroup v2 group for
+//   each job under the directory named by $BSH_CGROUP (a group to which the
+//   memory and cpu controllers have been delegated), writes the limits to it,
+//   and moves each child forked for the job into it.  Groups are removed once
+//   their jobs have exited.
+//
+// Command and process substitutions and the workers that run served command
+// lines (see serve.h) are jobs too.  Children of a job's processes (e.g., the
+// commands run by a subcommand) inherit its limits and group.
+
+#ifndef ULIMIT_INCLUDED
+#define ULIMIT_INCLUDED
+
+#include <sys/types.h>
+
+// Create the cgroup for the next job if cgroup limits are set; call before
+// forking the first child for a job.  Calls nest (e.g., a $(...) expanded
+// while forking a pipeline joins the group of the pipeline), and each must be
+// matched by a call to jobEnd().
+void jobBegin (void);
+
+// Move the child PID of the current job (0 for the current process) into its
+// group, and if PID is 0 apply the resource limits as well; call in both the
+// parent and the child after each fork for a job (as for setpgid()), so that
+// the group cannot be removed before the child is in it
+void jobJoin (pid_t pid);
+
+// Forget the cgroup of the current job and remove any groups whose jobs have
+// exited; call once the children for a job have been forked (or, for a job in
+// the foreground, have exited)
+void jobEnd (void);
+
+#endif